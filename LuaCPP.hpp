@@ -1,18 +1,54 @@
 #pragma once
+#include <new>
+#include <bit>
+#include <map>
 #include <list>
+#include <span>
+#include <array>
+#include <deque>
+#include <mutex>
 #include <tuple>
 #include <memory>
 #include <string>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <thread>
 #include <vector>
 #include <cassert>
+#include <climits>
+#include <cerrno>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <utility>
+#include <algorithm>
 #include <exception>
+#include <coroutine>
 #include <filesystem>
 #include <functional>
 #include <type_traits>
+#include <unordered_map>
+#include <condition_variable>
+
+#if defined(__linux__)
+	#include <time.h>
+	#include <sched.h>
+	#include <signal.h>
+	#include <pthread.h>
+	#include <poll.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
 
 #include <lua.hpp>
 
@@ -57,18 +93,43 @@ public:
 		Package
 	};
 
+	enum class Budgets
+	{
+		None,
+		Instructions,
+		Time
+	};
+
 	enum class FunctionTypes
 	{
 		None, C, Lua
 	};
 
+	enum class GCModes
+	{
+		Incremental,
+		Generational
+	};
+
+	class Table;
 	class Thread;
+	class AnchoredString;
+	class ExternalString;
+	class Channel;
+	template<typename T>
+	class ArrayView;
 	template<typename T>
 	class UserData;
 	template<typename F>
 	class Function;
+	template<typename F, size_t SIZE = 4 * sizeof(void*)>
+	class InlineFunction;
 	template<typename T>
 	class Optional;
+	template<typename ... T>
+	struct Yielding;
+	template<typename ... TArgs>
+	struct Constructor;
 
 private:
 	template<typename T>
@@ -112,11 +173,51 @@ private:
 	{
 		static constexpr bool Value = std::is_same<T, std::string_view>::value;
 	};
-	// template<typename T>
-	// struct Is_Table
-	// {
-	// 	static constexpr bool Value = std::is_same<T, Table>::value;
-	// };
+	template<typename T>
+	struct Is_AnchoredString
+	{
+		static constexpr bool Value = std::is_same<T, AnchoredString>::value;
+	};
+	template<typename T>
+	struct Is_ExternalString
+	{
+		static constexpr bool Value = std::is_same<T, ExternalString>::value;
+	};
+	template<typename T>
+	struct Is_Channel
+	{
+		static constexpr bool Value = std::is_same<T, Channel>::value;
+	};
+	template<typename T>
+	struct Is_Table
+	{
+		static constexpr bool Value = std::is_same<T, Table>::value;
+	};
+	template<typename T>
+	struct Is_Vector
+	{
+		static constexpr bool Value = false;
+	};
+	template<typename T, typename TAllocator>
+	struct Is_Vector<std::vector<T, TAllocator>>
+	{
+		static constexpr bool Value = true;
+	};
+	template<typename T>
+	struct Is_Map
+	{
+		static constexpr bool Value = false;
+	};
+	template<typename TKey, typename T, typename TCompare, typename TAllocator>
+	struct Is_Map<std::map<TKey, T, TCompare, TAllocator>>
+	{
+		static constexpr bool Value = true;
+	};
+	template<typename TKey, typename T, typename THash, typename TEqual, typename TAllocator>
+	struct Is_Map<std::unordered_map<TKey, T, THash, TEqual, TAllocator>>
+	{
+		static constexpr bool Value = true;
+	};
 	template<typename T>
 	struct Is_Tuple
 	{
@@ -138,6 +239,16 @@ private:
 		static constexpr bool Value = true;
 	};
 	template<typename T>
+	struct Is_InlineFunction
+	{
+		static constexpr bool Value = false;
+	};
+	template<typename F, size_t SIZE>
+	struct Is_InlineFunction<InlineFunction<F, SIZE>>
+	{
+		static constexpr bool Value = true;
+	};
+	template<typename T>
 	struct Is_CFunction
 	{
 		static constexpr bool Value = false;
@@ -158,6 +269,16 @@ private:
 		static constexpr bool Value = true;
 	};
 	template<typename T>
+	struct Is_Yielding
+	{
+		static constexpr bool Value = false;
+	};
+	template<typename ... T>
+	struct Is_Yielding<Yielding<T ...>>
+	{
+		static constexpr bool Value = true;
+	};
+	template<typename T>
 	struct Is_Thread
 	{
 		static constexpr bool Value = std::is_same<T, Thread>::value;
@@ -173,10 +294,60 @@ private:
 		static constexpr bool Value = true;
 	};
 	template<typename T>
+	struct Is_ArrayView
+	{
+		static constexpr bool Value = false;
+	};
+	template<typename T>
+	struct Is_ArrayView<ArrayView<T>>
+	{
+		static constexpr bool Value = true;
+	};
+	template<typename T>
 	struct Is_LightUserData
 	{
 		static constexpr bool Value = std::is_pointer<T>::value;
 	};
+	// Peek hands out handles that borrow the stack slot
+	template<typename T>
+	struct Is_Borrowed
+	{
+		static constexpr bool Value = Is_Table<T>::Value || Is_Thread<T>::Value || Is_UserData<T>::Value || Is_ArrayView<T>::Value || Is_AnchoredString<T>::Value;
+	};
+	template<typename T>
+	struct Is_Constructor
+	{
+		static constexpr bool Value = false;
+	};
+	template<typename ... T>
+	struct Is_Constructor<Constructor<T ...>>
+	{
+		static constexpr bool Value = true;
+	};
+
+	template<typename T>
+	struct Get_MemberFunction;
+	template<typename T, typename C, typename ... TArgs>
+	struct Get_MemberFunction<T(C::*)(TArgs ...)>
+	{
+		typedef T                                          Return;
+		typedef std::tuple<std::remove_cvref_t<TArgs> ...> Args;
+	};
+	template<typename T, typename C, typename ... TArgs>
+	struct Get_MemberFunction<T(C::*)(TArgs ...) const>
+		: public Get_MemberFunction<T(C::*)(TArgs ...)>
+	{
+	};
+	template<typename T, typename C, typename ... TArgs>
+	struct Get_MemberFunction<T(C::*)(TArgs ...) noexcept>
+		: public Get_MemberFunction<T(C::*)(TArgs ...)>
+	{
+	};
+	template<typename T, typename C, typename ... TArgs>
+	struct Get_MemberFunction<T(C::*)(TArgs ...) const noexcept>
+		: public Get_MemberFunction<T(C::*)(TArgs ...)>
+	{
+	};
 
 	template<typename T>
 	struct Get_Type
@@ -185,11 +356,16 @@ private:
 			Is_Null<T>::Value                          ? Types::Null :
 			Is_Number<T>::Value                        ? Types::Number :
 			Is_Boolean<T>::Value                       ? Types::Boolean :
-			(Is_String<T>::Value || Is_Char<T>::Value) ? Types::String :
-			// Is_Table<T>::Value                         ? Types::Table :
-			Is_Function<T>::Value                      ? Types::Function :
+			(Is_String<T>::Value || Is_Char<T>::Value ||
+			Is_AnchoredString<T>::Value ||
+			Is_ExternalString<T>::Value)               ? Types::String :
+			(Is_Table<T>::Value || Is_Vector<T>::Value ||
+			Is_Map<T>::Value)                          ? Types::Table :
+			(Is_Function<T>::Value ||
+			Is_InlineFunction<T>::Value)               ? Types::Function :
 			Is_Thread<T>::Value                        ? Types::Thread :
-			Is_UserData<T>::Value                      ? Types::UserData :
+			(Is_UserData<T>::Value || Is_ArrayView<T>::Value ||
+			Is_Channel<T>::Value)                      ? Types::UserData :
 			Is_LightUserData<T>::Value                 ? Types::LightUserData : Types::None;
 	};
 
@@ -223,6 +399,203 @@ private:
 	};
 
 public:
+	// Thrown when a call runs out of the budget set with SetBudget
+	class BudgetException
+		: public Exception
+	{
+		Budgets budget;
+
+	public:
+		BudgetException(std::string_view function, lua_State* lua, Budgets budget)
+			: Exception(function, lua),
+			budget(budget)
+		{
+		}
+
+		constexpr Budgets GetBudget() const
+		{
+			return budget;
+		}
+	};
+
+#if defined(LUACPP_INSTRUMENTATION)
+	// Snapshot of the counters of one C++ binding, aggregated across every state that bound its name.
+	// Latencies cover the whole call, Peek of the arguments included, in log-linear buckets of 8 per power of two.
+	struct BindingStats
+	{
+		static constexpr size_t SUB_BUCKET_BITS  = 3;
+		static constexpr size_t SUB_BUCKET_COUNT = size_t(1) << SUB_BUCKET_BITS;
+		static constexpr size_t BUCKET_COUNT     = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+		std::string                        name;
+		uint64_t                           calls;
+		std::chrono::nanoseconds           peek_time;
+		std::chrono::nanoseconds           body_time;
+		std::chrono::nanoseconds           latency_max;
+		std::array<uint64_t, BUCKET_COUNT> latency_histogram;
+
+		// @return bucket holding a latency of ns nanoseconds
+		static constexpr size_t   GetBucket(uint64_t ns)
+		{
+			if (ns < SUB_BUCKET_COUNT)
+				return static_cast<size_t>(ns);
+
+			size_t exponent = std::bit_width(ns) - 1;
+
+			return ((exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT) + static_cast<size_t>((ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1));
+		}
+		// @return lowest latency in nanoseconds that falls into bucket
+		static constexpr uint64_t GetBucketValue(size_t bucket)
+		{
+			if (bucket < SUB_BUCKET_COUNT)
+				return bucket;
+
+			size_t exponent = (bucket / SUB_BUCKET_COUNT) + SUB_BUCKET_BITS - 1;
+
+			return (SUB_BUCKET_COUNT + (bucket % SUB_BUCKET_COUNT)) << (exponent - SUB_BUCKET_BITS);
+		}
+
+		// @param percentile 0 to 100
+		// @return highest latency of the bucket the percentile falls into, capped at latency_max
+		std::chrono::nanoseconds GetPercentile(double percentile) const
+		{
+			if (calls == 0)
+				return std::chrono::nanoseconds(0);
+
+			auto     rank  = static_cast<uint64_t>((percentile / 100.0) * static_cast<double>(calls));
+			uint64_t count = 0;
+
+			for (size_t i = 0; i < BUCKET_COUNT; ++i)
+				if ((count += latency_histogram[i]) > rank)
+				{
+					auto value = (i + 1 < BUCKET_COUNT) ? (GetBucketValue(i + 1) - 1) : UINT64_MAX;
+
+					return (std::min)(std::chrono::nanoseconds(static_cast<int64_t>((std::min<uint64_t>)(value, INT64_MAX))), latency_max);
+				}
+
+			return latency_max;
+		}
+	};
+
+private:
+	// Live counters of a binding name, entries are never erased so closures can keep raw pointers
+	class Binding
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		struct Registry
+		{
+			std::mutex                                  mutex;
+			std::map<std::string, Binding, std::less<>> bindings;
+		};
+
+		std::atomic<uint64_t>                                         calls       = 0;
+		std::atomic<uint64_t>                                         peek_time   = 0;
+		std::atomic<uint64_t>                                         body_time   = 0;
+		std::atomic<uint64_t>                                         latency_max = 0;
+		std::array<std::atomic<uint64_t>, BindingStats::BUCKET_COUNT> latency_histogram {};
+
+	public:
+		static Binding* Register(std::string_view name)
+		{
+			auto&                       registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			auto it = registry.bindings.find(name);
+
+			if (it == registry.bindings.end())
+				it = registry.bindings.try_emplace(std::string(name)).first;
+
+			return &it->second;
+		}
+
+		static std::vector<BindingStats> GetSnapshot()
+		{
+			auto&                       registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			std::vector<BindingStats>   snapshot;
+
+			snapshot.reserve(registry.bindings.size());
+
+			for (auto& [name, binding] : registry.bindings)
+			{
+				auto& stats = snapshot.emplace_back();
+
+				stats.name        = name;
+				stats.calls       = binding.calls.load(std::memory_order_relaxed);
+				stats.peek_time   = std::chrono::nanoseconds(binding.peek_time.load(std::memory_order_relaxed));
+				stats.body_time   = std::chrono::nanoseconds(binding.body_time.load(std::memory_order_relaxed));
+				stats.latency_max = std::chrono::nanoseconds(binding.latency_max.load(std::memory_order_relaxed));
+
+				for (size_t i = 0; i < BindingStats::BUCKET_COUNT; ++i)
+					stats.latency_histogram[i] = binding.latency_histogram[i].load(std::memory_order_relaxed);
+			}
+
+			return snapshot;
+		}
+
+		static void Reset()
+		{
+			auto&                       registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			for (auto& [name, binding] : registry.bindings)
+			{
+				binding.calls.store(0, std::memory_order_relaxed);
+				binding.peek_time.store(0, std::memory_order_relaxed);
+				binding.body_time.store(0, std::memory_order_relaxed);
+				binding.latency_max.store(0, std::memory_order_relaxed);
+
+				for (auto& bucket : binding.latency_histogram)
+					bucket.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		// Peeks every argument into a tuple before calling so marshaling is timed apart from the body,
+		// the body includes pushing the return value
+		template<typename T, typename TArguments, typename TPeek, typename F>
+		int Execute(lua_State* lua, TPeek&& peek, F&& function)
+		{
+			int        result;
+			auto       start     = Clock::now();
+			TArguments arguments = peek();
+			auto       peeked    = Clock::now();
+
+			if constexpr (std::is_same<T, void>::value)
+				std::apply(function, std::move(arguments)), result = 0;
+			else
+				result = Push(lua, std::apply(function, std::move(arguments)));
+
+			auto finish = Clock::now();
+
+			Record(static_cast<uint64_t>((peeked - start).count()), static_cast<uint64_t>((finish - peeked).count()), static_cast<uint64_t>((finish - start).count()));
+
+			return result;
+		}
+
+	private:
+		static Registry& GetRegistry()
+		{
+			static Registry registry;
+
+			return registry;
+		}
+
+		void Record(uint64_t peek, uint64_t body, uint64_t latency)
+		{
+			calls.fetch_add(1, std::memory_order_relaxed);
+			peek_time.fetch_add(peek, std::memory_order_relaxed);
+			body_time.fetch_add(body, std::memory_order_relaxed);
+			latency_histogram[BindingStats::GetBucket(latency)].fetch_add(1, std::memory_order_relaxed);
+
+			for (auto max = latency_max.load(std::memory_order_relaxed); (latency > max) && !latency_max.compare_exchange_weak(max, latency, std::memory_order_relaxed); )
+				;
+		}
+	};
+
+public:
+#endif
+
 	template<typename T, typename ... TArgs>
 	class Function<T(TArgs ...)>
 	{
@@ -245,6 +618,9 @@ public:
 			{
 				if constexpr (std::is_same<T, void>::value)
 					return function(Peek<I>(lua) ...), 0;
+				// deduced, naming it would instantiate Optional<Yielding>
+				else if constexpr (Is_Yielding<T_RETURN>::Value)
+					return Push(lua, function(Peek<I>(lua) ...));
 				else
 					return Push<T_RETURN>(lua, function(Peek<I>(lua) ...));
 			}
@@ -263,15 +639,17 @@ public:
 			// @throw std::exception
 			static constexpr T_RETURN LuaProtected(lua_State* lua, T_ARGS ... args)
 			{
+				BudgetScope budget(lua);
+
 				if constexpr (std::is_same<T, void>::value)
 				{
 					if (lua_pcall(lua, (Push<T_ARGS>(lua, args) + ...), 0, 0) != LUA_OK)
-						throw Exception("lua_pcall", lua);
+						ThrowError("lua_pcall", lua);
 				}
 				else
 				{
 					if (lua_pcall(lua, (Push<T_ARGS>(lua, args) + ...), LUA_MULTRET, 0) != LUA_OK)
-						throw Exception(lua, "lua_pcall");
+						ThrowError("lua_pcall", lua);
 
 					return Pop<-1, T_RETURN>(lua);
 				}
@@ -404,6 +782,27 @@ public:
 			throw Exception("LuaCPP::Function::ExecuteProtected", "context->type == FunctionTypes::None");
 		}
 
+		// Calls the function once per argument tuple, resolving it only once per batch
+		// @param arguments range of tuples convertible to TArgs
+		// @param output receives one result per call
+		// @return output past the last result
+		// @throw std::exception
+		template<typename TRange, typename TOutput>
+			requires (!std::is_same<T, void>::value)
+		TOutput ExecuteBatch(const TRange& arguments, TOutput output) const
+		{
+			Batch(arguments, [&output](T&& value) { *output++ = std::move(value); });
+
+			return output;
+		}
+		// @throw std::exception
+		template<typename TRange>
+			requires std::is_same<T, void>::value
+		void    ExecuteBatch(const TRange& arguments) const
+		{
+			Batch(arguments, nullptr);
+		}
+
 		void Release()
 		{
 			context.reset();
@@ -475,11 +874,118 @@ public:
 			return value;
 		}
 
+		// @throw std::exception
+		template<typename TRange, typename F>
+		void Batch(const TRange& arguments, F&& sink) const
+		{
+			assert(context);
+
+			switch (context->type)
+			{
+				case FunctionTypes::C:
+					for (auto& args : arguments)
+					{
+						if constexpr (std::is_same<T, void>::value)
+							std::apply(context->function, args);
+						else
+							sink(std::apply(context->function, args));
+					}
+					return;
+
+				case FunctionTypes::Lua:
+					break;
+
+				default:
+					throw Exception("LuaCPP::Function::ExecuteBatch", "context->type == FunctionTypes::None");
+			}
+
+			auto lua = context->lua;
+			auto top = lua_gettop(lua);
+
+			if (int type = lua_rawgeti(lua, LUA_REGISTRYINDEX, context->reference); type != LUA_TFUNCTION)
+			{
+				lua_settop(lua, top);
+
+				throw Exception("lua_rawgeti", type);
+			}
+
+			BudgetScope budget(lua);
+
+			try
+			{
+				if (!lua_checkstack(lua, 1 + static_cast<int>(sizeof...(TArgs))))
+					throw Exception("lua_checkstack", "stack overflow");
+
+				constexpr int result_count = std::is_same<T, void>::value ? 0 : 1;
+
+				size_t i = 0;
+
+				for (auto& args : arguments)
+				{
+					lua_pushvalue(lua, top + 1);
+
+					int arg_count = std::apply([lua](const auto& ... values)
+					{
+						return (0 + ... + LuaCPP::Push(lua, static_cast<const TArgs&>(values)));
+					}, args);
+
+					if (lua_pcall(lua, arg_count, result_count, 0) != LUA_OK)
+						ThrowError(std::string("LuaCPP::Function::ExecuteBatch call #").append(std::to_string(i)), lua);
+
+					if constexpr (!std::is_same<T, void>::value)
+					{
+						T value;
+
+						if (!LuaCPP::Peek(lua, lua_gettop(lua), value))
+							throw Exception("LuaCPP::Function::ExecuteBatch", std::string("Error popping return value #").append(std::to_string(i)));
+
+						if constexpr (Is_Borrowed<T>::Value)
+							value.Pin();
+
+						lua_pop(lua, 1);
+						sink(std::move(value));
+					}
+
+					++i;
+				}
+			}
+			catch (...)
+			{
+				lua_settop(lua, top);
+
+				throw;
+			}
+
+			lua_settop(lua, top);
+		}
+
 	private:
-		static constexpr int ExecuteC(lua_State* lua)
+		static int ExecuteC(lua_State* lua)
+		{
+			auto context = reinterpret_cast<const Context*>(lua_touserdata(lua, lua_upvalueindex(1)));
+
+#if defined(LUACPP_INSTRUMENTATION)
+			// closures pushed by SetGlobal carry the Binding of their name as upvalue 2
+			auto binding = static_cast<Binding*>(lua_touserdata(lua, lua_upvalueindex(2)));
+			int  result  = binding ? ExecuteC(lua, *binding, context->function, std::make_index_sequence<sizeof...(TArgs)> {}) : Detour<T(TArgs ...)>::C(lua, context->function);
+#else
+			int result = Detour<T(TArgs ...)>::C(lua, context->function);
+#endif
+
+			Hooks::SampleBinding(lua);
+
+			if constexpr (Is_Yielding<T>::Value)
+				return lua_yieldk(lua, result, 0, nullptr);
+			else
+				return result;
+		}
+#if defined(LUACPP_INSTRUMENTATION)
+		template<size_t ... I>
+		static int ExecuteC(lua_State* lua, Binding& binding, const CFunction& function, std::index_sequence<I ...>)
 		{
-			return Detour<T(TArgs ...)>::C(lua, reinterpret_cast<const Context*>(lua_touserdata(lua, lua_upvalueindex(1)))->function);
+			return binding.Execute<T, std::tuple<TArgs ...>>(lua, [lua]() { return std::tuple<TArgs ...> { Peek<I>(lua) ... }; }, function);
 		}
+#endif
 		static constexpr T   ExecuteLua(lua_State* lua, TArgs ... args)
 		{
 			return Detour<T(TArgs ...)>::Lua(lua, std::forward<TArgs>(args) ...);
@@ -490,46 +996,241 @@ public:
 		}
 	};
 
-	template<typename T>
-	class Optional
+	// Function for C++ callables that never touches the heap: callables up to SIZE bytes
+	// are stored in place and type-erased through a static table instead of std::function.
+	// When pushed, stateless callables become plain C functions and anything else is
+	// copied into a full userdata upvalue the closure reads directly.
+	template<typename T, typename ... TArgs, size_t SIZE>
+	class InlineFunction<T(TArgs ...), SIZE>
 	{
 		friend LuaCPP;
 
-		static_assert(Get_Type<T>::Value != Types::None);
+		static constexpr size_t ALIGNMENT = (alignof(lua_Number) > alignof(void*)) ? alignof(lua_Number) : alignof(void*);
 
-		bool       is_set = false;
+		struct VTable
+		{
+			T    (*invoke)(void* callable, TArgs ... args);
+			void (*copy)(void* destination, const void* source);
+			void (*destroy)(void* callable);
+			void (*push)(lua_State* lua, const void* callable);
+		};
 
-		T          value;
+		template<typename F>
+		struct Is_Stateless
+		{
+			static constexpr bool Value = std::is_empty<F>::value && std::is_default_constructible<F>::value;
+		};
+
+		alignas(ALIGNMENT) uint8_t storage[SIZE];
+		const VTable*              vtable;
 
 	public:
-		Optional()
+		InlineFunction()
+			: vtable(nullptr)
 		{
 		}
 
-		Optional(Optional&& optional)
-			: is_set(optional.is_set),
-			value(std::move(optional.value))
+		template<typename F>
+			requires (!std::is_same<typename std::decay<F>::type, InlineFunction>::value) && std::is_invocable_r<T, F&, TArgs ...>::value
+		InlineFunction(F&& function)
+			: vtable(&VTABLE<typename std::decay<F>::type>)
 		{
-			optional.is_set = false;
+			typedef typename std::decay<F>::type Callable;
+
+			static_assert(sizeof(Callable) <= SIZE, "callable exceeds inline storage, raise SIZE");
+			static_assert(alignof(Callable) <= ALIGNMENT);
+			static_assert(std::is_copy_constructible<Callable>::value);
+
+			new (storage) Callable(std::forward<F>(function));
 		}
-		Optional(const Optional& optional)
-			: is_set(optional.is_set),
-			value(optional.value)
+
+		InlineFunction(const InlineFunction& function)
+			: vtable(function.vtable)
 		{
+			if (vtable != nullptr)
+				vtable->copy(storage, function.storage);
 		}
 
-		virtual ~Optional()
+		virtual ~InlineFunction()
 		{
+			Release();
 		}
 
-		constexpr operator bool () const
+		T Execute(TArgs ... args) const
 		{
-			return is_set;
+			assert(vtable != nullptr);
+
+			return vtable->invoke(const_cast<uint8_t*>(storage), std::forward<TArgs>(args) ...);
 		}
 
-		constexpr const T& operator * () const
+		void Release()
 		{
-			return value;
+			if (vtable != nullptr)
+			{
+				vtable->destroy(storage);
+				vtable = nullptr;
+			}
+		}
+
+		constexpr operator bool() const
+		{
+			return vtable != nullptr;
+		}
+
+		auto& operator = (const InlineFunction& function)
+		{
+			if (this != &function)
+			{
+				Release();
+
+				if (function.vtable != nullptr)
+				{
+					function.vtable->copy(storage, function.storage);
+					vtable = function.vtable;
+				}
+			}
+
+			return *this;
+		}
+
+	private:
+		void PushValue(lua_State* lua) const
+		{
+			if (vtable != nullptr)
+				vtable->push(lua, storage);
+			else
+				lua_pushnil(lua);
+		}
+
+		template<typename F>
+		static void PushCallable(lua_State* lua, const void* callable)
+		{
+			if constexpr (Is_Stateless<F>::Value)
+				lua_pushcfunction(lua, &InlineFunction::ExecuteC<F>);
+			else
+			{
+				new (lua_newuserdatauv(lua, sizeof(F), 0)) F(*static_cast<const F*>(callable));
+
+				if constexpr (!std::is_trivially_destructible<F>::value)
+				{
+					if (lua_rawgetp(lua, LUA_REGISTRYINDEX, &VTABLE<F>) != LUA_TTABLE)
+					{
+						lua_pop(lua, 1);
+						lua_createtable(lua, 0, 1);
+						lua_pushcfunction(lua, &InlineFunction::Finalize<F>);
+						lua_setfield(lua, -2, "__gc");
+						lua_pushvalue(lua, -1);
+						lua_rawsetp(lua, LUA_REGISTRYINDEX, &VTABLE<F>);
+					}
+
+					lua_setmetatable(lua, -2);
+				}
+
+				lua_pushcclosure(lua, &InlineFunction::ExecuteC<F>, 1);
+			}
+		}
+
+		template<typename F>
+		static int  ExecuteC(lua_State* lua)
+		{
+			int result;
+
+			if constexpr (Is_Stateless<F>::Value)
+			{
+				F function;
+
+				result = ExecuteC(lua, function, std::make_index_sequence<sizeof...(TArgs)> {});
+			}
+			else
+				result = ExecuteC(lua, *static_cast<F*>(lua_touserdata(lua, lua_upvalueindex(1))), std::make_index_sequence<sizeof...(TArgs)> {});
+
+			Hooks::SampleBinding(lua);
+
+			if constexpr (Is_Yielding<T>::Value)
+				return lua_yieldk(lua, result, 0, nullptr);
+			else
+				return result;
+		}
+		template<typename F, size_t ... I>
+		static int  ExecuteC(lua_State* lua, F& function, std::index_sequence<I ...>)
+		{
+			int error_index = 0;
+
+			// arguments go out of scope before lua_error unwinds past this frame
+			{
+				std::tuple<typename std::decay<TArgs>::type ...> args;
+
+				if (((LuaCPP::Peek(lua, 1 + I, std::get<I>(args)) || ((error_index = 1 + I), false)) && ...))
+				{
+					if constexpr (std::is_same<T, void>::value)
+						return function(std::get<I>(args) ...), 0;
+					else
+						return LuaCPP::Push(lua, function(std::get<I>(args) ...));
+				}
+			}
+
+			return luaL_error(lua, "Error peeking arg #%d", error_index);
+		}
+
+		template<typename F>
+		static int  Finalize(lua_State* lua)
+		{
+			static_cast<F*>(lua_touserdata(lua, 1))->~F();
+
+			return 0;
+		}
+
+		// address is unique per F and used as the registry key of its metatable
+		template<typename F>
+		static constexpr VTable VTABLE =
+		{
+			.invoke  = [](void* callable, TArgs ... args) -> T { return (*static_cast<F*>(callable))(std::forward<TArgs>(args) ...); },
+			.copy    = [](void* destination, const void* source) { new (destination) F(*static_cast<const F*>(source)); },
+			.destroy = [](void* callable) { static_cast<F*>(callable)->~F(); },
+			.push    = &InlineFunction::PushCallable<F>
+		};
+	};
+
+	template<typename T>
+	class Optional
+	{
+		friend LuaCPP;
+
+		static_assert(Get_Type<T>::Value != Types::None);
+
+		bool       is_set = false;
+
+		T          value;
+
+	public:
+		Optional()
+		{
+		}
+
+		Optional(Optional&& optional)
+			: is_set(optional.is_set),
+			value(std::move(optional.value))
+		{
+			optional.is_set = false;
+		}
+		Optional(const Optional& optional)
+			: is_set(optional.is_set),
+			value(optional.value)
+		{
+		}
+
+		virtual ~Optional()
+		{
+		}
+
+		constexpr operator bool () const
+		{
+			return is_set;
+		}
+
+		constexpr const T& operator * () const
+		{
+			return value;
 		}
 
 		constexpr const T* operator -> () const
@@ -538,129 +1239,5400 @@ public:
 		}
 	};
 
-	template<auto F>
-	class CFunction
+	// Return type for bound C++ functions (CFunction, Function, InlineFunction) that suspend the
+	// calling coroutine. The values are passed to the resumer and the call evaluates to the values
+	// the coroutine is resumed with. The binding yields only after every C++ local of the call
+	// is gone, calling it where the state cannot yield raises a Lua error.
+	template<typename ... T>
+	struct Yielding
 	{
-		template<typename>
-		class Detour;
-		template<typename T, typename ... TArgs>
-		class Detour<T(*)(TArgs ...)>
+		std::tuple<T ...> values;
+
+		Yielding(T ... values)
+			: values(std::move(values) ...)
 		{
-			Detour() = delete;
+		}
+	};
 
-		public:
-			static constexpr int Execute(lua_State* lua)
+	// Handle to a global that keeps its interned name (and optionally its value) in the registry,
+	// so repeated access skips building and hashing the key.
+	// Must not outlive the state it was created from.
+	template<typename T>
+	class GlobalRef
+	{
+		static_assert(Get_Type<T>::Value != Types::None);
+
+		// stands in for nil in the pinned slot, a nil there would let luaL_ref hand the slot out twice
+		static constexpr char NIL_ID = 0;
+
+		lua_State* lua;
+		int        key;
+		int        value;
+
+		GlobalRef(const GlobalRef&) = delete;
+
+	public:
+		GlobalRef()
+			: lua(nullptr),
+			key(LUA_NOREF),
+			value(LUA_NOREF)
+		{
+		}
+
+		// @param pin_value resolve the value once and serve reads from the registry,
+		//                  assignments made by scripts are not observed until Refresh
+		GlobalRef(lua_State* lua, std::string_view name, bool pin_value = Is_Function<T>::Value)
+			: lua(lua),
+			key(LUA_NOREF),
+			value(LUA_NOREF)
+		{
+			lua_pushlstring(lua, name.data(), name.length());
+			key = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+			if (pin_value)
 			{
-				return Execute(lua, std::make_index_sequence<sizeof...(TArgs)> {});
+				lua_pushboolean(lua, 0);
+				value = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+				Refresh();
 			}
-			template<size_t ... I>
-			static constexpr int Execute(lua_State* lua, std::index_sequence<I ...>)
+		}
+
+		GlobalRef(GlobalRef&& ref)
+			: lua(ref.lua),
+			key(ref.key),
+			value(ref.value)
+		{
+			ref.lua   = nullptr;
+			ref.key   = LUA_NOREF;
+			ref.value = LUA_NOREF;
+		}
+
+		virtual ~GlobalRef()
+		{
+			Release();
+		}
+
+		constexpr bool IsPinned() const
+		{
+			return value != LUA_NOREF;
+		}
+
+		auto GetType() const
+		{
+			assert(lua != nullptr);
+
+			auto type = PushValue();
+			lua_pop(lua, 1);
+
+			return static_cast<Types>(type);
+		}
+
+		// @return 0 on not found
+		// @return -1 on invalid type
+		int  Get(T& value) const
+		{
+			assert(lua != nullptr);
+
+			auto type = PushValue();
+
+			if (type == LUA_TNIL)
 			{
-				if constexpr (std::is_same<T, void>::value)
-					return F(Peek<I>(lua) ...), 0;
-				else
-					return Push(lua, F(Peek<I>(lua) ...));
+				lua_pop(lua, 1);
+
+				return 0;
 			}
 
-		private:
-			template<size_t I>
-			static constexpr auto Peek(lua_State* lua)
+			if (type != static_cast<int>(Get_Type<T>::Value))
 			{
-				typename std::tuple_element<I, std::tuple<TArgs ...>>::type value;
+				lua_pop(lua, 1);
 
-				if (!LuaCPP::Peek(lua, 1 + I, value))
-				{
-					lua_pushfstring(lua, "Error peeking arg #%s", std::to_string(1 + I).c_str());
-					lua_error(lua);
-				}
+				return -1;
+			}
 
-				return value;
+			bool result = Peek(lua, lua_gettop(lua), value);
+
+			if constexpr (Is_Borrowed<T>::Value)
+				value.Pin();
+
+			lua_pop(lua, 1);
+
+			return result ? 1 : 0;
+		}
+
+		void Set(const T& value)
+		{
+			assert(lua != nullptr);
+
+			lua_rawgeti(lua, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+			lua_rawgeti(lua, LUA_REGISTRYINDEX, key);
+			Push(lua, value);
+
+			if (IsPinned())
+			{
+				lua_pushvalue(lua, -1);
+				SetPinnedValue();
+			}
+
+			lua_settable(lua, -3);
+			lua_pop(lua, 1);
+		}
+
+		// Re-reads the global into the pinned slot
+		void Refresh()
+		{
+			assert(lua != nullptr);
+
+			if (IsPinned())
+			{
+				PushGlobal();
+				SetPinnedValue();
+			}
+		}
+
+		void Release()
+		{
+			if (lua)
+			{
+				luaL_unref(lua, LUA_REGISTRYINDEX, key);
+				luaL_unref(lua, LUA_REGISTRYINDEX, value);
+
+				lua   = nullptr;
+				key   = LUA_NOREF;
+				value = LUA_NOREF;
+			}
+		}
+
+		constexpr operator bool() const
+		{
+			return lua != nullptr;
+		}
+
+		auto& operator = (GlobalRef&& ref)
+		{
+			Release();
+
+			lua       = ref.lua;
+			key       = ref.key;
+			value     = ref.value;
+			ref.lua   = nullptr;
+			ref.key   = LUA_NOREF;
+			ref.value = LUA_NOREF;
+
+			return *this;
+		}
+
+	private:
+		int PushValue() const
+		{
+			if (!IsPinned())
+				return PushGlobal();
+
+			auto type = lua_rawgeti(lua, LUA_REGISTRYINDEX, value);
+
+			if ((type == LUA_TLIGHTUSERDATA) && (lua_touserdata(lua, -1) == &NIL_ID))
+			{
+				lua_pop(lua, 1);
+				lua_pushnil(lua);
+
+				return LUA_TNIL;
 			}
+
+			return type;
+		}
+
+		// Pops the value into the pinned slot
+		void SetPinnedValue()
+		{
+			if (lua_isnil(lua, -1))
+			{
+				lua_pop(lua, 1);
+				lua_pushlightuserdata(lua, const_cast<char*>(&NIL_ID));
+			}
+
+			lua_rawseti(lua, LUA_REGISTRYINDEX, value);
+		}
+
+		int PushGlobal() const
+		{
+			lua_rawgeti(lua, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+			lua_rawgeti(lua, LUA_REGISTRYINDEX, key);
+
+			auto type = lua_gettable(lua, -2);
+			lua_remove(lua, -2);
+
+			return type;
+		}
+	};
+
+	// C++ object constructed in place inside a full userdata and destroyed by __gc.
+	// A handle either keeps the object alive through a registry reference (Create, Pin)
+	// or borrows it from a stack slot (Peek), borrowed handles are only valid while that slot is.
+	template<typename T>
+	class UserData
+	{
+		friend LuaCPP;
+
+		static_assert(alignof(T) <= ((alignof(lua_Number) > alignof(void*)) ? alignof(lua_Number) : alignof(void*)));
+
+		struct Block
+		{
+			const void* type;
+			alignas(T) uint8_t value[sizeof(T)];
 		};
 
-		CFunction() = delete;
+		// address is unique per T and used as the registry key of the metatable
+		static constexpr char TYPE_ID = 0;
+
+		lua_State* lua;
+		Block*     block;
+		int        index;
+		int        reference;
+
+		UserData(lua_State* lua, Block* block, int index)
+			: lua(lua),
+			block(block),
+			index(index),
+			reference(LUA_NOREF)
+		{
+		}
 
 	public:
-		static constexpr int Execute(lua_State* lua)
+		UserData()
+			: lua(nullptr),
+			block(nullptr),
+			index(0),
+			reference(LUA_NOREF)
 		{
-			return Detour<decltype(F)>::Execute(lua);
 		}
-	};
 
-private:
-	lua_State* lua;
-	bool       lua_is_owned;
+		UserData(UserData&& user_data)
+			: lua(user_data.lua),
+			block(user_data.block),
+			index(user_data.index),
+			reference(user_data.reference)
+		{
+			user_data.lua       = nullptr;
+			user_data.block     = nullptr;
+			user_data.index     = 0;
+			user_data.reference = LUA_NOREF;
+		}
+		UserData(const UserData& user_data)
+			: lua(user_data.lua),
+			block(user_data.block),
+			index(user_data.index),
+			reference(LUA_NOREF)
+		{
+			if (user_data.reference != LUA_NOREF)
+			{
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, user_data.reference);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+			}
+		}
+
+		virtual ~UserData()
+		{
+			Release();
+		}
+
+		// @throw std::exception
+		template<typename ... TArgs>
+		static UserData Create(lua_State* lua, TArgs&& ... args)
+		{
+			UserData user_data(lua, New(lua, std::forward<TArgs>(args) ...), 0);
+			user_data.reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+			return user_data;
+		}
+
+		constexpr bool IsPinned() const
+		{
+			return reference != LUA_NOREF;
+		}
+
+		constexpr T* Get() const
+		{
+			return block ? reinterpret_cast<T*>(block->value) : nullptr;
+		}
+
+		// Keeps a borrowed object alive beyond its stack slot
+		void Pin()
+		{
+			if (!IsPinned() && (index != 0))
+			{
+				lua_pushvalue(lua, index);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+				index     = 0;
+			}
+		}
+
+		void Release()
+		{
+			if (IsPinned())
+				luaL_unref(lua, LUA_REGISTRYINDEX, reference);
+
+			lua       = nullptr;
+			block     = nullptr;
+			index     = 0;
+			reference = LUA_NOREF;
+		}
+
+		constexpr operator bool() const
+		{
+			return block != nullptr;
+		}
+
+		constexpr T& operator * () const
+		{
+			return *Get();
+		}
+
+		constexpr T* operator -> () const
+		{
+			return Get();
+		}
+
+		auto& operator = (UserData&& user_data)
+		{
+			Release();
+
+			lua                 = user_data.lua;
+			block               = user_data.block;
+			index               = user_data.index;
+			reference           = user_data.reference;
+			user_data.lua       = nullptr;
+			user_data.block     = nullptr;
+			user_data.index     = 0;
+			user_data.reference = LUA_NOREF;
+
+			return *this;
+		}
+		auto& operator = (const UserData& user_data)
+		{
+			if (this != &user_data)
+				*this = UserData(user_data);
+
+			return *this;
+		}
+
+		constexpr bool operator == (const UserData& user_data) const
+		{
+			return block == user_data.block;
+		}
+		constexpr bool operator != (const UserData& user_data) const
+		{
+			return !operator==(user_data);
+		}
+
+	private:
+		// Leaves the new userdata on the stack
+		// @throw std::exception
+		template<typename ... TArgs>
+		static Block* New(lua_State* lua, TArgs&& ... args)
+		{
+			auto block = reinterpret_cast<Block*>(lua_newuserdatauv(lua, sizeof(Block), 0));
+
+			block->type = nullptr;
+
+			try
+			{
+				new (block->value) T(std::forward<TArgs>(args) ...);
+			}
+			catch (...)
+			{
+				lua_pop(lua, 1);
+
+				throw;
+			}
+
+			block->type = &TYPE_ID;
+
+			PushMetatable(lua);
+			lua_setmetatable(lua, -2);
+
+			return block;
+		}
+
+		void PushValue(lua_State* lua) const
+		{
+			if (IsPinned())
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, reference);
+			else if (index != 0)
+				lua_pushvalue(lua, index);
+			else
+				lua_pushnil(lua);
+		}
+
+		// @return nullptr if the value is not a live T
+		static Block* ToBlock(lua_State* lua, int index)
+		{
+			if ((lua_type(lua, index) != LUA_TUSERDATA) || (lua_rawlen(lua, index) != sizeof(Block)))
+				return nullptr;
+
+			auto block = reinterpret_cast<Block*>(lua_touserdata(lua, index));
+
+			return (block->type == &TYPE_ID) ? block : nullptr;
+		}
+
+		static void PushMetatable(lua_State* lua)
+		{
+			if (lua_rawgetp(lua, LUA_REGISTRYINDEX, &TYPE_ID) == LUA_TTABLE)
+				return;
+
+			lua_pop(lua, 1);
+			lua_createtable(lua, 0, 2);
+			lua_pushcfunction(lua, &UserData::Finalize);
+			lua_setfield(lua, -2, "__gc");
+			lua_pushliteral(lua, "LuaCPP::UserData");
+			lua_setfield(lua, -2, "__name");
+			lua_pushvalue(lua, -1);
+			lua_rawsetp(lua, LUA_REGISTRYINDEX, &TYPE_ID);
+		}
+
+		static int  Finalize(lua_State* lua)
+		{
+			if (auto block = ToBlock(lua, 1))
+			{
+				block->type = nullptr;
+
+				reinterpret_cast<T*>(block->value)->~T();
+			}
+
+			return 0;
+		}
+	};
+
+	// Handle to a Lua table, either kept alive through a registry reference (Create, Pin)
+	// or borrowed from a stack slot (Peek), borrowed handles are only valid while that slot is.
+	// Element access is raw and ignores metamethods.
+	class Table
+	{
+		friend LuaCPP;
+
+		lua_State* lua;
+		int        index;
+		int        reference;
+
+		Table(lua_State* lua, int index)
+			: lua(lua),
+			index(index),
+			reference(LUA_NOREF)
+		{
+		}
+
+	public:
+		Table()
+			: lua(nullptr),
+			index(0),
+			reference(LUA_NOREF)
+		{
+		}
+
+		Table(Table&& table)
+			: lua(table.lua),
+			index(table.index),
+			reference(table.reference)
+		{
+			table.lua       = nullptr;
+			table.index     = 0;
+			table.reference = LUA_NOREF;
+		}
+		Table(const Table& table)
+			: lua(table.lua),
+			index(table.index),
+			reference(LUA_NOREF)
+		{
+			if (table.reference != LUA_NOREF)
+			{
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, table.reference);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+			}
+		}
+
+		virtual ~Table()
+		{
+			Release();
+		}
+
+		// @param array_size pre-allocated array slots
+		// @param hash_size pre-allocated hash slots
+		static Table Create(lua_State* lua, int array_size = 0, int hash_size = 0)
+		{
+			lua_createtable(lua, array_size, hash_size);
+
+			Table table(lua, 0);
+			table.reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+			return table;
+		}
+
+		constexpr bool IsPinned() const
+		{
+			return reference != LUA_NOREF;
+		}
+
+		// @return length of the array part as seen by lua_rawlen
+		size_t GetLength() const
+		{
+			assert(lua != nullptr);
+
+			PushValue(lua);
+			auto length = lua_rawlen(lua, -1);
+			lua_pop(lua, 1);
+
+			return static_cast<size_t>(length);
+		}
+
+		// @return false if not found or on invalid type
+		template<typename TKey, typename T>
+		bool Get(const TKey& key, T& value) const
+		{
+			assert(lua != nullptr);
+
+			PushValue(lua);
+			LuaCPP::Push(lua, key);
+
+			if (lua_rawget(lua, -2) != static_cast<int>(Get_Type<T>::Value))
+			{
+				lua_pop(lua, 2);
+
+				return false;
+			}
+
+			bool result = Peek(lua, lua_gettop(lua), value);
+
+			if constexpr (Is_Borrowed<T>::Value)
+				value.Pin();
+
+			lua_pop(lua, 2);
+
+			return result;
+		}
+
+		template<typename TKey, typename T>
+		void Set(const TKey& key, const T& value)
+		{
+			assert(lua != nullptr);
+
+			PushValue(lua);
+			LuaCPP::Push(lua, key);
+			LuaCPP::Push(lua, value);
+			lua_rawset(lua, -3);
+			lua_pop(lua, 1);
+		}
+
+		// Keeps a borrowed table alive beyond its stack slot
+		void Pin()
+		{
+			if (!IsPinned() && (index != 0))
+			{
+				lua_pushvalue(lua, index);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+				index     = 0;
+			}
+		}
+
+		void Release()
+		{
+			if (IsPinned())
+				luaL_unref(lua, LUA_REGISTRYINDEX, reference);
+
+			lua       = nullptr;
+			index     = 0;
+			reference = LUA_NOREF;
+		}
+
+		constexpr operator bool() const
+		{
+			return (lua != nullptr) && (IsPinned() || (index != 0));
+		}
+
+		auto& operator = (Table&& table)
+		{
+			Release();
+
+			lua             = table.lua;
+			index           = table.index;
+			reference       = table.reference;
+			table.lua       = nullptr;
+			table.index     = 0;
+			table.reference = LUA_NOREF;
+
+			return *this;
+		}
+		auto& operator = (const Table& table)
+		{
+			if (this != &table)
+				*this = Table(table);
+
+			return *this;
+		}
+
+	private:
+		void PushValue(lua_State* lua) const
+		{
+			if (IsPinned())
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, reference);
+			else if (index != 0)
+				lua_pushvalue(lua, index);
+			else
+				lua_pushnil(lua);
+		}
+	};
+
+	// Handle to a Lua string that keeps it alive instead of copying it, either through the stack
+	// slot it was peeked from (function arguments, free but only valid for the call) or through a
+	// registry reference (Pin, Pop). The view is valid for as long as the string is anchored.
+	class AnchoredString
+	{
+		friend LuaCPP;
+
+		lua_State*       lua;
+		int              index;
+		int              reference;
+		std::string_view view;
+
+		AnchoredString(lua_State* lua, int index, std::string_view view)
+			: lua(lua),
+			index(index),
+			reference(LUA_NOREF),
+			view(view)
+		{
+		}
+
+	public:
+		AnchoredString()
+			: lua(nullptr),
+			index(0),
+			reference(LUA_NOREF)
+		{
+		}
+
+		AnchoredString(AnchoredString&& string)
+			: lua(string.lua),
+			index(string.index),
+			reference(string.reference),
+			view(string.view)
+		{
+			string.lua       = nullptr;
+			string.index     = 0;
+			string.reference = LUA_NOREF;
+			string.view      = std::string_view();
+		}
+		AnchoredString(const AnchoredString& string)
+			: lua(string.lua),
+			index(string.index),
+			reference(LUA_NOREF),
+			view(string.view)
+		{
+			if (string.reference != LUA_NOREF)
+			{
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, string.reference);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+			}
+		}
+
+		virtual ~AnchoredString()
+		{
+			Release();
+		}
+
+		constexpr bool IsPinned() const
+		{
+			return reference != LUA_NOREF;
+		}
+
+		constexpr const char* GetData() const
+		{
+			return view.data();
+		}
+
+		constexpr size_t GetSize() const
+		{
+			return view.size();
+		}
+
+		constexpr std::string_view GetView() const
+		{
+			return view;
+		}
+
+		// Keeps a borrowed string alive beyond its stack slot
+		void Pin()
+		{
+			if (!IsPinned() && (index != 0))
+			{
+				lua_pushvalue(lua, index);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+				index     = 0;
+			}
+		}
+
+		void Release()
+		{
+			if (IsPinned())
+				luaL_unref(lua, LUA_REGISTRYINDEX, reference);
+
+			lua       = nullptr;
+			index     = 0;
+			reference = LUA_NOREF;
+			view      = std::string_view();
+		}
+
+		constexpr operator bool() const
+		{
+			return (lua != nullptr) && (IsPinned() || (index != 0));
+		}
+
+		constexpr operator std::string_view() const
+		{
+			return view;
+		}
+
+		auto& operator = (AnchoredString&& string)
+		{
+			Release();
+
+			lua              = string.lua;
+			index            = string.index;
+			reference        = string.reference;
+			view             = string.view;
+			string.lua       = nullptr;
+			string.index     = 0;
+			string.reference = LUA_NOREF;
+			string.view      = std::string_view();
+
+			return *this;
+		}
+		auto& operator = (const AnchoredString& string)
+		{
+			if (this != &string)
+				*this = AnchoredString(string);
+
+			return *this;
+		}
+
+	private:
+		void PushValue(lua_State* lua) const
+		{
+			if (IsPinned())
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, reference);
+			else if (index != 0)
+				lua_pushvalue(lua, index);
+			else
+				lua_pushnil(lua);
+		}
+	};
+
+	// Buffer handed to Lua without copying, for large payloads. Every Push on 5.5 is a
+	// lua_pushexternalstring that holds a reference to the buffer until Lua frees the string,
+	// so the ExternalString itself may go away right after. 5.4 has no external strings and
+	// falls back to copying on every Push. Push only, strings read back are plain Lua strings.
+	class ExternalString
+	{
+		friend LuaCPP;
+
+#if defined(LUACPP_IS_LUA55)
+		// ud of the external string, owned by Lua once the push succeeded
+		struct Holder
+		{
+			std::shared_ptr<const void> owner;
+			// set while the push runs so a failed one knows whether Lua already freed it
+			bool*                       is_freed;
+		};
+#endif
+
+		std::shared_ptr<const void> owner;
+		std::string_view            view;
+
+	public:
+		ExternalString()
+		{
+		}
+
+		ExternalString(std::string&& string)
+		{
+			auto buffer = std::make_shared<const std::string>(std::move(string));
+
+			view  = *buffer;
+			owner = std::move(buffer);
+		}
+		// Appends the terminator Lua requires, which reallocates only if the vector is at capacity
+		ExternalString(std::vector<char>&& buffer)
+		{
+			buffer.push_back('\0');
+
+			auto shared = std::make_shared<const std::vector<char>>(std::move(buffer));
+
+			view  = std::string_view(shared->data(), shared->size() - 1);
+			owner = std::move(shared);
+		}
+		ExternalString(std::shared_ptr<const std::string> string)
+			: owner(string),
+			view(string ? std::string_view(*string) : std::string_view())
+		{
+		}
+		// @param owner keeps view alive, may be an aliasing shared_ptr
+		// @param view view.data()[view.size()] must be readable and '\0' as 5.5 requires
+		ExternalString(std::shared_ptr<const void> owner, std::string_view view)
+			: owner(std::move(owner)),
+			view(view)
+		{
+		}
+
+		constexpr std::string_view GetView() const
+		{
+			return view;
+		}
+
+		operator bool() const
+		{
+			return owner != nullptr;
+		}
+
+	private:
+		void PushValue(lua_State* lua) const
+		{
+			if (!owner)
+				lua_pushnil(lua);
+			else
+			{
+#if defined(LUACPP_IS_LUA54)
+				lua_pushlstring(lua, view.data(), view.length());
+#elif defined(LUACPP_IS_LUA55)
+				// protected, a memory error would otherwise jump past the holder and leak the buffer
+				bool is_freed = false;
+				auto holder   = new Holder { owner, &is_freed };
+
+				lua_pushcfunction(lua, &ExternalString::PushExternal);
+				lua_pushlightuserdata(lua, const_cast<ExternalString*>(this));
+				lua_pushlightuserdata(lua, holder);
+
+				if (lua_pcall(lua, 2, 1, 0) != LUA_OK)
+				{
+					if (!is_freed)
+						delete holder;
+
+					lua_error(lua);
+				}
+
+				if (!is_freed)
+					holder->is_freed = nullptr;
+#endif
+			}
+		}
+
+#if defined(LUACPP_IS_LUA55)
+		static int   PushExternal(lua_State* lua)
+		{
+			auto string = static_cast<const ExternalString*>(lua_touserdata(lua, 1));
+
+			// short strings are interned, Lua then copies and calls Free right away
+			lua_pushexternalstring(lua, string->view.data(), string->view.length(), &ExternalString::Free, lua_touserdata(lua, 2));
+
+			return 1;
+		}
+
+		static void* Free(void* ud, [[maybe_unused]] void* ptr, [[maybe_unused]] size_t osize, [[maybe_unused]] size_t nsize)
+		{
+			auto holder = static_cast<Holder*>(ud);
+
+			if (holder->is_freed != nullptr)
+				*holder->is_freed = true;
+
+			delete holder;
+
+			return nullptr;
+		}
+#endif
+	};
+
+	// Handle to a Lua coroutine, pinned (Create) or borrowed from a stack slot (Peek).
+	// Resume drives it from C++, Await lets a C++20 coroutine co_await it instead:
+	// if the Lua coroutine yields, the awaiting coroutine is suspended and picked up
+	// again by whichever Resume finally finishes it. Close, Release of the awaited handle
+	// or destroying the suspended coroutine drop it without resuming.
+	class Thread
+	{
+		friend LuaCPP;
+
+		lua_State* lua;
+		lua_State* state;
+		int        index;
+		int        reference;
+		int        result_count;
+		void*      waiter;
+
+		Thread(lua_State* lua, lua_State* state, int index)
+			: lua(lua),
+			state(state),
+			index(index),
+			reference(LUA_NOREF),
+			result_count(0),
+			waiter(nullptr)
+		{
+		}
+
+	public:
+		template<typename T, typename ... TArgs>
+		class Awaiter
+		{
+			friend Thread;
+
+			// temporaries of the co_await expression outlive the suspension
+			Thread*               thread;
+			std::tuple<TArgs ...> args;
+			lua_State*            lua;
+			lua_State*            state;
+			void*                 waiter;
+
+			template<typename ... T_ARGS>
+			Awaiter(Thread& thread, T_ARGS&& ... args)
+				: thread(&thread),
+				args(std::forward<T_ARGS>(args) ...),
+				lua(nullptr),
+				state(nullptr),
+				waiter(nullptr)
+			{
+			}
+
+		public:
+			Awaiter(const Awaiter&) = delete;
+
+			// the awaiting coroutine was destroyed while suspended
+			~Awaiter()
+			{
+				if (waiter != nullptr)
+					Unpark(lua, state, waiter);
+			}
+
+			// @throw std::exception
+			bool await_ready()
+			{
+				return !std::apply([this](auto& ... args) { return thread->Resume(args ...); }, args);
+			}
+
+			void await_suspend(std::coroutine_handle<> handle)
+			{
+				lua            = thread->lua;
+				state          = thread->state;
+				waiter         = handle.address();
+				thread->waiter = waiter;
+
+				lua_pushlightuserdata(lua, waiter);
+				lua_rawsetp(lua, LUA_REGISTRYINDEX, state);
+			}
+
+			// @throw std::exception
+			T await_resume()
+			{
+				waiter = nullptr;
+
+				if (lua_status(thread->state) > LUA_YIELD)
+					throw Exception("lua_resume", thread->state);
+
+				if constexpr (std::is_same<T, void>::value)
+					lua_settop(thread->state, 0);
+				else
+				{
+					T value;
+
+					if ((lua_gettop(thread->state) == 0) || !LuaCPP::Peek(thread->state, 1, value))
+					{
+						lua_settop(thread->state, 0);
+
+						throw Exception("LuaCPP::Thread::Await", "Error popping return value");
+					}
+
+					if constexpr (Is_Borrowed<T>::Value)
+						value.Pin();
+
+					lua_settop(thread->state, 0);
+
+					return value;
+				}
+			}
+		};
+
+		Thread()
+			: lua(nullptr),
+			state(nullptr),
+			index(0),
+			reference(LUA_NOREF),
+			result_count(0),
+			waiter(nullptr)
+		{
+		}
+
+		Thread(Thread&& thread)
+			: lua(thread.lua),
+			state(thread.state),
+			index(thread.index),
+			reference(thread.reference),
+			result_count(thread.result_count),
+			waiter(thread.waiter)
+		{
+			thread.lua          = nullptr;
+			thread.state        = nullptr;
+			thread.index        = 0;
+			thread.reference    = LUA_NOREF;
+			thread.result_count = 0;
+			thread.waiter       = nullptr;
+		}
+		Thread(const Thread& thread)
+			: lua(thread.lua),
+			state(thread.state),
+			index(thread.index),
+			reference(LUA_NOREF),
+			result_count(thread.result_count),
+			waiter(nullptr)
+		{
+			if (thread.reference != LUA_NOREF)
+			{
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, thread.reference);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+			}
+		}
+
+		virtual ~Thread()
+		{
+			Release();
+		}
+
+		// Creates a coroutine, push its body onto GetState() before the first Resume
+		static Thread Create(lua_State* lua)
+		{
+			Thread thread(lua, lua_newthread(lua), 0);
+			thread.reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+			return thread;
+		}
+
+		constexpr bool IsPinned() const
+		{
+			return reference != LUA_NOREF;
+		}
+
+		constexpr lua_State* GetState() const
+		{
+			return state;
+		}
+
+		// @return LUA_OK, LUA_YIELD or the error that killed the coroutine
+		int  GetStatus() const
+		{
+			assert(state != nullptr);
+
+			return lua_status(state);
+		}
+
+		bool IsYielded() const
+		{
+			return GetStatus() == LUA_YIELD;
+		}
+
+		// @return number of values yielded or returned by the last Resume
+		constexpr size_t GetResultCount() const
+		{
+			return static_cast<size_t>(result_count);
+		}
+
+		// Results stay on the coroutine stack until the next Resume
+		// @return false if out of range or on invalid type
+		template<typename T>
+		bool GetResult(size_t i, T& value) const
+		{
+			assert(state != nullptr);
+
+			if (i >= GetResultCount())
+				return false;
+
+			return Peek(state, static_cast<size_t>(lua_gettop(state) - result_count) + 1 + i, value);
+		}
+
+		// @return true if the coroutine yielded, false once it returned
+		// @throw std::exception
+		template<typename ... TArgs>
+		bool Resume(TArgs&& ... args)
+		{
+			assert(state != nullptr);
+
+			if (lua_status(state) == LUA_YIELD)
+				lua_pop(state, result_count);
+
+			BudgetScope budget(state);
+
+			int arg_count = (0 + ... + LuaCPP::Push(state, args));
+			int status    = lua_resume(state, lua, arg_count, &result_count);
+
+			if (status == LUA_YIELD)
+				return true;
+
+			// an awaiting coroutine takes over the results or the error
+			if (lua_rawgetp(lua, LUA_REGISTRYINDEX, state) == LUA_TLIGHTUSERDATA)
+			{
+				auto handle = std::coroutine_handle<>::from_address(lua_touserdata(lua, -1));
+
+				lua_pop(lua, 1);
+				lua_pushnil(lua);
+				lua_rawsetp(lua, LUA_REGISTRYINDEX, state);
+
+				waiter = nullptr;
+				handle.resume();
+
+				return false;
+			}
+
+			lua_pop(lua, 1);
+
+			if (status != LUA_OK)
+			{
+				result_count = 0;
+
+				ThrowError("lua_resume", state);
+			}
+
+			return false;
+		}
+
+		// Resumes the coroutine from a C++20 coroutine, co_await yields the first result as T
+		template<typename T = void, typename ... TArgs>
+		auto Await(TArgs&& ... args)
+		{
+			return Awaiter<T, typename std::decay<TArgs>::type ...>(*this, std::forward<TArgs>(args) ...);
+		}
+
+		// Resets a dead or suspended coroutine so it can run a new body,
+		// a coroutine awaiting it is dropped and never resumed
+		void Close()
+		{
+			assert(state != nullptr);
+
+			Unpark(lua, state, nullptr);
+			lua_closethread(state, lua);
+			result_count = 0;
+			waiter       = nullptr;
+		}
+
+		// Keeps a borrowed coroutine alive beyond its stack slot
+		void Pin()
+		{
+			if (!IsPinned() && (index != 0))
+			{
+				lua_pushvalue(lua, index);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+				index     = 0;
+			}
+		}
+
+		void Release()
+		{
+			// an Awaiter of this handle can't be resumed through it anymore
+			if (waiter != nullptr)
+				Unpark(lua, state, waiter);
+
+			if (IsPinned())
+				luaL_unref(lua, LUA_REGISTRYINDEX, reference);
+
+			lua          = nullptr;
+			state        = nullptr;
+			index        = 0;
+			reference    = LUA_NOREF;
+			result_count = 0;
+			waiter       = nullptr;
+		}
+
+		constexpr operator bool() const
+		{
+			return state != nullptr;
+		}
+
+		auto& operator = (Thread&& thread)
+		{
+			Release();
+
+			lua                 = thread.lua;
+			state               = thread.state;
+			index               = thread.index;
+			reference           = thread.reference;
+			result_count        = thread.result_count;
+			waiter              = thread.waiter;
+			thread.lua          = nullptr;
+			thread.state        = nullptr;
+			thread.index        = 0;
+			thread.reference    = LUA_NOREF;
+			thread.result_count = 0;
+			thread.waiter       = nullptr;
+
+			return *this;
+		}
+		auto& operator = (const Thread& thread)
+		{
+			if (this != &thread)
+				*this = Thread(thread);
+
+			return *this;
+		}
+
+		constexpr bool operator == (const Thread& thread) const
+		{
+			return state == thread.state;
+		}
+		constexpr bool operator != (const Thread& thread) const
+		{
+			return !operator==(thread);
+		}
+
+	private:
+		void PushValue(lua_State* lua) const
+		{
+			if (IsPinned())
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, reference);
+			else if (index != 0)
+				lua_pushvalue(lua, index);
+			else
+				lua_pushnil(lua);
+		}
+
+		// Removes the coroutine parked on state, any if waiter is nullptr
+		static void Unpark(lua_State* lua, lua_State* state, void* waiter)
+		{
+			if ((lua_rawgetp(lua, LUA_REGISTRYINDEX, state) == LUA_TLIGHTUSERDATA) && ((waiter == nullptr) || (lua_touserdata(lua, -1) == waiter)))
+			{
+				lua_pushnil(lua);
+				lua_rawsetp(lua, LUA_REGISTRYINDEX, state);
+			}
+
+			lua_pop(lua, 1);
+		}
+	};
+
+	// Exposes C++ memory to Lua as a 1-based array userdata without copying it.
+	// The view owns the proxy, scripts holding on to it after Release, Reset or
+	// destruction get an error instead of touching stale memory.
+	// A view of const T is read-only, integer writes outside the range of T raise an error.
+	// Views obtained through Peek borrow the proxy and never expire it.
+	template<typename T>
+	class ArrayView
+	{
+		friend LuaCPP;
+
+		typedef typename std::remove_const<T>::type Value;
+
+		static_assert(std::is_arithmetic<Value>::value && !std::is_same<Value, bool>::value);
+
+		struct Block
+		{
+			const void* type;
+			T*          data;
+			size_t      size;
+		};
+
+		// address is unique per T and used as the registry key of the metatable
+		static constexpr char TYPE_ID = 0;
+
+		lua_State* lua;
+		Block*     block;
+		int        index;
+		int        reference;
+		bool       is_owner;
+
+		ArrayView(const ArrayView&) = delete;
+
+		ArrayView(lua_State* lua, Block* block, int index)
+			: lua(lua),
+			block(block),
+			index(index),
+			reference(LUA_NOREF),
+			is_owner(false)
+		{
+		}
+
+	public:
+		ArrayView()
+			: lua(nullptr),
+			block(nullptr),
+			index(0),
+			reference(LUA_NOREF),
+			is_owner(false)
+		{
+		}
+
+		ArrayView(lua_State* lua, std::span<T> span)
+			: lua(lua),
+			block(reinterpret_cast<Block*>(lua_newuserdatauv(lua, sizeof(Block), 0))),
+			index(0),
+			is_owner(true)
+		{
+			block->type = &TYPE_ID;
+			block->data = span.data();
+			block->size = span.size();
+
+			PushMetatable(lua);
+			lua_setmetatable(lua, -2);
+
+			reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+		}
+
+		template<typename C>
+			requires std::is_constructible<std::span<T>, C&>::value
+		ArrayView(lua_State* lua, C& container)
+			: ArrayView(lua, std::span<T>(container))
+		{
+		}
+
+		ArrayView(ArrayView&& view)
+			: lua(view.lua),
+			block(view.block),
+			index(view.index),
+			reference(view.reference),
+			is_owner(view.is_owner)
+		{
+			view.lua       = nullptr;
+			view.block     = nullptr;
+			view.index     = 0;
+			view.reference = LUA_NOREF;
+			view.is_owner  = false;
+		}
+
+		virtual ~ArrayView()
+		{
+			Release();
+		}
+
+		constexpr bool IsValid() const
+		{
+			return (block != nullptr) && (block->data != nullptr);
+		}
+
+		constexpr bool IsPinned() const
+		{
+			return reference != LUA_NOREF;
+		}
+
+		constexpr std::span<T> GetSpan() const
+		{
+			return IsValid() ? std::span<T>(block->data, block->size) : std::span<T>();
+		}
+
+		// Points the proxy at new memory, e.g. after the buffer was reallocated
+		void Reset(std::span<T> span)
+		{
+			assert(block != nullptr);
+
+			block->data = span.data();
+			block->size = span.size();
+		}
+
+		// Keeps a borrowed view alive beyond its stack slot
+		void Pin()
+		{
+			if (!IsPinned() && (index != 0))
+			{
+				lua_pushvalue(lua, index);
+				reference = luaL_ref(lua, LUA_REGISTRYINDEX);
+				index     = 0;
+			}
+		}
+
+		// Expires the proxy if this view owns it, the memory may be freed afterwards
+		void Release()
+		{
+			if ((block != nullptr) && is_owner)
+			{
+				block->data = nullptr;
+				block->size = 0;
+			}
+
+			if (IsPinned())
+				luaL_unref(lua, LUA_REGISTRYINDEX, reference);
+
+			lua       = nullptr;
+			block     = nullptr;
+			index     = 0;
+			reference = LUA_NOREF;
+			is_owner  = false;
+		}
+
+		constexpr operator bool() const
+		{
+			return IsValid();
+		}
+
+		auto& operator = (ArrayView&& view)
+		{
+			Release();
+
+			lua            = view.lua;
+			block          = view.block;
+			index          = view.index;
+			reference      = view.reference;
+			is_owner       = view.is_owner;
+			view.lua       = nullptr;
+			view.block     = nullptr;
+			view.index     = 0;
+			view.reference = LUA_NOREF;
+			view.is_owner  = false;
+
+			return *this;
+		}
+
+	private:
+		void PushValue(lua_State* lua) const
+		{
+			if (IsPinned())
+				lua_rawgeti(lua, LUA_REGISTRYINDEX, reference);
+			else if (index != 0)
+				lua_pushvalue(lua, index);
+			else
+				lua_pushnil(lua);
+		}
+
+		// @return nullptr if the value is not a view of T
+		static Block* TryToBlock(lua_State* lua, int index)
+		{
+			auto block = reinterpret_cast<Block*>(lua_touserdata(lua, index));
+
+			if ((block == nullptr) || (lua_rawlen(lua, index) != sizeof(Block)) || (block->type != &TYPE_ID))
+				return nullptr;
+
+			return block;
+		}
+
+		// Raises a Lua error if the value is not a live view
+		static Block* ToBlock(lua_State* lua, int index)
+		{
+			auto block = TryToBlock(lua, index);
+
+			if (block == nullptr)
+				luaL_typeerror(lua, index, "LuaCPP::ArrayView");
+
+			if (block->data == nullptr)
+				luaL_error(lua, "array view expired");
+
+			return block;
+		}
+
+		static void PushMetatable(lua_State* lua)
+		{
+			if (lua_rawgetp(lua, LUA_REGISTRYINDEX, &TYPE_ID) == LUA_TTABLE)
+				return;
+
+			lua_pop(lua, 1);
+			lua_createtable(lua, 0, 5);
+			lua_pushcfunction(lua, &ArrayView::Index);
+			lua_setfield(lua, -2, "__index");
+			lua_pushcfunction(lua, &ArrayView::NewIndex);
+			lua_setfield(lua, -2, "__newindex");
+			lua_pushcfunction(lua, &ArrayView::Length);
+			lua_setfield(lua, -2, "__len");
+			lua_pushcfunction(lua, &ArrayView::Pairs);
+			lua_setfield(lua, -2, "__pairs");
+			lua_pushliteral(lua, "LuaCPP::ArrayView");
+			lua_setfield(lua, -2, "__name");
+			lua_pushvalue(lua, -1);
+			lua_rawsetp(lua, LUA_REGISTRYINDEX, &TYPE_ID);
+		}
+
+		// Out of range reads return nil so ipairs and # style loops terminate
+		static int  Index(lua_State* lua)
+		{
+			auto block = ToBlock(lua, 1);
+			int  is_integer;
+			auto i     = lua_tointegerx(lua, 2, &is_integer);
+
+			if (!is_integer || (i < 1) || (static_cast<lua_Unsigned>(i) > block->size))
+				return 0;
+
+			return LuaCPP::Push(lua, block->data[i - 1]);
+		}
+
+		static int  NewIndex(lua_State* lua)
+		{
+			auto block = ToBlock(lua, 1);
+
+			if constexpr (std::is_const<T>::value)
+				return luaL_error(lua, "array view is read-only");
+			else
+			{
+				auto i = luaL_checkinteger(lua, 2);
+
+				luaL_argcheck(lua, (i >= 1) && (static_cast<lua_Unsigned>(i) <= block->size), 2, "index out of range");
+
+				if constexpr (std::is_floating_point<T>::value)
+					block->data[i - 1] = static_cast<T>(luaL_checknumber(lua, 3));
+				else
+				{
+					auto value = luaL_checkinteger(lua, 3);
+
+					// narrower types must round-trip, 64 bit unsigned keeps the bit pattern
+					luaL_argcheck(lua, static_cast<lua_Integer>(static_cast<T>(value)) == value, 3, "value out of range");
+
+					block->data[i - 1] = static_cast<T>(value);
+				}
+
+				return 0;
+			}
+		}
+
+		static int  Length(lua_State* lua)
+		{
+			lua_pushinteger(lua, static_cast<lua_Integer>(ToBlock(lua, 1)->size));
+
+			return 1;
+		}
+
+		static int  Pairs(lua_State* lua)
+		{
+			ToBlock(lua, 1);
+
+			lua_pushcfunction(lua, &ArrayView::Next);
+			lua_pushvalue(lua, 1);
+			lua_pushinteger(lua, 0);
+
+			return 3;
+		}
+
+		static int  Next(lua_State* lua)
+		{
+			auto block = ToBlock(lua, 1);
+			auto i     = luaL_checkinteger(lua, 2);
+
+			if ((i < 0) || (static_cast<lua_Unsigned>(i) >= block->size))
+				return 0;
+
+			lua_pushinteger(lua, i + 1);
+
+			return 1 + LuaCPP::Push(lua, block->data[i]);
+		}
+	};
+
+	// Compile-time string usable as a template argument
+	template<size_t N>
+	struct Name
+	{
+		char value[N];
+
+		constexpr Name(const char (&value)[N])
+		{
+			for (size_t i = 0; i < N; ++i)
+				this->value[i] = value[i];
+		}
+
+		constexpr std::string_view GetString() const
+		{
+			return std::string_view(value, N - 1);
+		}
+	};
+
+	// Members for RegisterClass
+	template<Name NAME, auto F>
+	struct Method
+	{
+	};
+	// @param GET pointer to a data member or a getter
+	// @param SET setter, nullptr for data members and read-only properties
+	template<Name NAME, auto GET, auto SET = nullptr>
+	struct Property
+	{
+	};
+	template<typename ... TArgs>
+	struct Constructor
+	{
+	};
+
+	template<auto F>
+	class CFunction
+	{
+		template<typename>
+		class Detour;
+		template<typename T, typename ... TArgs>
+		class Detour<T(*)(TArgs ...)>
+		{
+			Detour() = delete;
+
+		public:
+			typedef T Return;
+
+			static constexpr int Execute(lua_State* lua)
+			{
+				return Execute(lua, std::make_index_sequence<sizeof...(TArgs)> {});
+			}
+			template<size_t ... I>
+			static constexpr int Execute(lua_State* lua, std::index_sequence<I ...>)
+			{
+#if defined(LUACPP_INSTRUMENTATION)
+				if (auto binding = static_cast<Binding*>(lua_touserdata(lua, lua_upvalueindex(1))))
+					return binding->Execute<T, std::tuple<TArgs ...>>(lua, [lua]() { return std::tuple<TArgs ...> { Peek<I>(lua) ... }; }, F);
+#endif
+
+				if constexpr (std::is_same<T, void>::value)
+					return F(Peek<I>(lua) ...), 0;
+				else
+					return Push(lua, F(Peek<I>(lua) ...));
+			}
+
+		private:
+			template<size_t I>
+			static constexpr auto Peek(lua_State* lua)
+			{
+				typename std::tuple_element<I, std::tuple<TArgs ...>>::type value;
+
+				if (!LuaCPP::Peek(lua, 1 + I, value))
+				{
+					lua_pushfstring(lua, "Error peeking arg #%s", std::to_string(1 + I).c_str());
+					lua_error(lua);
+				}
+
+				return value;
+			}
+		};
+
+		CFunction() = delete;
+
+	public:
+		static int Execute(lua_State* lua)
+		{
+			int result = Detour<decltype(F)>::Execute(lua);
+
+			Hooks::SampleBinding(lua);
+
+			if constexpr (Is_Yielding<typename Detour<decltype(F)>::Return>::Value)
+				return lua_yieldk(lua, result, 0, nullptr);
+			else
+				return result;
+		}
+	};
+
+	// Per-state allocator that serves the small blocks Lua churns through
+	// (strings, tables, nodes, closures) from size-class slabs and falls back
+	// to malloc for everything else.
+	// Must outlive every state created with it and must not be shared across threads.
+	class SlabAllocator
+	{
+		static constexpr size_t CLASS_GRANULARITY = alignof(std::max_align_t);
+		static constexpr size_t CLASS_COUNT       = 256 / CLASS_GRANULARITY;
+		static constexpr size_t SLAB_SIZE         = 16 * 1024;
+
+		struct Block
+		{
+			Block* next;
+		};
+
+		struct alignas(std::max_align_t) Slab
+		{
+			Slab* next;
+		};
+
+		Block* blocks[CLASS_COUNT] = {};
+		Slab*  slabs               = nullptr;
+		size_t slab_count          = 0;
+
+		SlabAllocator(SlabAllocator&&) = delete;
+		SlabAllocator(const SlabAllocator&) = delete;
+
+	public:
+		SlabAllocator()
+		{
+		}
+
+		virtual ~SlabAllocator()
+		{
+			while (auto slab = slabs)
+			{
+				slabs = slab->next;
+
+				std::free(slab);
+			}
+		}
+
+		constexpr auto GetSlabCount() const
+		{
+			return slab_count;
+		}
+
+		constexpr auto GetSlabSize() const
+		{
+			return SLAB_SIZE;
+		}
+
+		// lua_Alloc compatible entry point, param must be a SlabAllocator*
+		static void* Alloc(void* param, void* block, size_t old_size, size_t new_size)
+		{
+			auto allocator = reinterpret_cast<SlabAllocator*>(param);
+
+			// old_size is an object type tag when block is null
+			if (block == nullptr)
+				old_size = 0;
+
+			if (new_size == 0)
+			{
+				if (block != nullptr)
+					allocator->Free(block, old_size);
+
+				return nullptr;
+			}
+
+			if (block != nullptr)
+			{
+				auto old_class = GetClass(old_size);
+				auto new_class = GetClass(new_size);
+
+				if (old_class == new_class)
+					return (new_class == CLASS_COUNT) ? std::realloc(block, new_size) : block;
+			}
+
+			auto new_block = allocator->Allocate(new_size);
+
+			if ((new_block != nullptr) && (block != nullptr))
+			{
+				std::memcpy(new_block, block, (old_size < new_size) ? old_size : new_size);
+
+				allocator->Free(block, old_size);
+			}
+
+			return new_block;
+		}
+
+	private:
+		// @return CLASS_COUNT if size is served by malloc
+		static constexpr size_t GetClass(size_t size)
+		{
+			return (size > (CLASS_COUNT * CLASS_GRANULARITY)) ? CLASS_COUNT : ((size + CLASS_GRANULARITY - 1) / CLASS_GRANULARITY - 1);
+		}
+
+		void* Allocate(size_t size)
+		{
+			auto size_class = GetClass(size);
+
+			if (size_class == CLASS_COUNT)
+				return std::malloc(size);
+
+			if ((blocks[size_class] == nullptr) && !Refill(size_class))
+				return nullptr;
+
+			auto block          = blocks[size_class];
+			blocks[size_class] = block->next;
+
+			return block;
+		}
+
+		void  Free(void* block, size_t size)
+		{
+			auto size_class = GetClass(size);
+
+			if (size_class == CLASS_COUNT)
+				std::free(block);
+			else
+			{
+				auto free_block    = reinterpret_cast<Block*>(block);
+				free_block->next   = blocks[size_class];
+				blocks[size_class] = free_block;
+			}
+		}
+
+		bool  Refill(size_t size_class)
+		{
+			auto slab = reinterpret_cast<Slab*>(std::malloc(SLAB_SIZE));
+
+			if (slab == nullptr)
+				return false;
+
+			slab->next = slabs;
+			slabs      = slab;
+			++slab_count;
+
+			auto block_size  = (size_class + 1) * CLASS_GRANULARITY;
+			auto block_count = (SLAB_SIZE - sizeof(Slab)) / block_size;
+			auto first_block = reinterpret_cast<uint8_t*>(slab) + sizeof(Slab);
+
+			for (size_t i = block_count; i > 0; --i)
+				Free(first_block + (i - 1) * block_size, block_size);
+
+			return true;
+		}
+	};
+
+	struct MemoryStats
+	{
+		// allocation tags are the Lua type of the new object, LUA_NUMTYPES (upvalue) or
+		// LUA_NUMTYPES + 1 (prototype). Non-object memory (arrays, buffers) is tagged 0, which
+		// would read as LUA_TNIL, and is counted under TAG_OTHER with any unknown tag instead
+		static constexpr size_t TAG_COUNT = LUA_NUMTYPES + 3;
+		static constexpr size_t TAG_OTHER = TAG_COUNT - 1;
+
+		size_t bytes;
+		size_t bytes_peak;
+		size_t bytes_limit;
+		size_t allocations;
+		size_t allocations_failed;
+		size_t allocations_by_tag[TAG_COUNT];
+
+		constexpr auto GetAllocationCount(Types type) const
+		{
+			return (type == Types::None) ? 0 : allocations_by_tag[static_cast<size_t>(type)];
+		}
+	};
+
+	// Allocator that tracks live/peak bytes and allocation counts per object type
+	// and enforces an optional hard limit before forwarding to another lua_Alloc.
+	// Allocations beyond the limit fail and surface as LUA_ERRMEM.
+	// Must outlive every state created with it and must not be shared across threads.
+	class AccountingAllocator
+	{
+		lua_Alloc   alloc;
+		void*       alloc_param;
+		MemoryStats stats = {};
+
+		AccountingAllocator(AccountingAllocator&&) = delete;
+		AccountingAllocator(const AccountingAllocator&) = delete;
+
+	public:
+		explicit AccountingAllocator(size_t limit = 0)
+			: AccountingAllocator(&DefaultAlloc, nullptr, limit)
+		{
+		}
+		AccountingAllocator(lua_Alloc alloc, void* param, size_t limit = 0)
+			: alloc(alloc),
+			alloc_param(param)
+		{
+			stats.bytes_limit = limit;
+		}
+		AccountingAllocator(SlabAllocator& allocator, size_t limit = 0)
+			: AccountingAllocator(&SlabAllocator::Alloc, &allocator, limit)
+		{
+		}
+
+		virtual ~AccountingAllocator()
+		{
+		}
+
+		constexpr auto& GetStats() const
+		{
+			return stats;
+		}
+
+		constexpr auto GetLimit() const
+		{
+			return stats.bytes_limit;
+		}
+
+		// @param value 0 to disable
+		void SetLimit(size_t value)
+		{
+			stats.bytes_limit = value;
+		}
+
+		// lua_Alloc compatible entry point, param must be an AccountingAllocator*
+		static void* Alloc(void* param, void* block, size_t old_size, size_t new_size)
+		{
+			auto  allocator = reinterpret_cast<AccountingAllocator*>(param);
+			auto& stats     = allocator->stats;
+			auto  tag       = old_size;
+
+			// old_size is an object type tag when block is null
+			if (block == nullptr)
+				old_size = 0;
+
+			if ((stats.bytes_limit != 0) && (new_size > old_size) && ((stats.bytes - old_size + new_size) > stats.bytes_limit))
+			{
+				++stats.allocations_failed;
+
+				return nullptr;
+			}
+
+			auto new_block = allocator->alloc(allocator->alloc_param, block, (block == nullptr) ? tag : old_size, new_size);
+
+			if ((new_block == nullptr) && (new_size != 0))
+			{
+				++stats.allocations_failed;
+
+				return nullptr;
+			}
+
+			stats.bytes = stats.bytes - old_size + new_size;
+
+			if (stats.bytes > stats.bytes_peak)
+				stats.bytes_peak = stats.bytes;
+
+			if ((block == nullptr) && (new_size != 0))
+			{
+				++stats.allocations;
+				++stats.allocations_by_tag[((tag != LUA_TNIL) && (tag < MemoryStats::TAG_OTHER)) ? tag : MemoryStats::TAG_OTHER];
+			}
+
+			return new_block;
+		}
+
+	private:
+		static void* DefaultAlloc(void* param, void* block, size_t old_size, size_t new_size)
+		{
+			if (new_size == 0)
+			{
+				std::free(block);
+
+				return nullptr;
+			}
+
+			return std::realloc(block, new_size);
+		}
+	};
+
+	// Keeps a set of fully initialized states and hands them out through RAII handles.
+	// On check-in a state is restored to the globals, library tables, package.loaded
+	// and named registry entries it had right after initialization. The restore is
+	// shallow, values nested deeper than one level below _G are not rolled back.
+	// Thread safe, each checked out state is still single-threaded.
+	class Pool
+	{
+	public:
+		typedef std::function<void(LuaCPP& lua)> Initializer;
+
+		struct Stats
+		{
+			size_t                   hits;
+			size_t                   misses;
+			size_t                   resets;
+			size_t                   resets_failed;
+			std::chrono::nanoseconds reset_time;
+			std::chrono::nanoseconds reset_time_max;
+		};
+
+	private:
+		struct Entry
+		{
+			std::unique_ptr<LuaCPP> lua;
+			int                     snapshot;
+		};
+
+	public:
+		class Handle
+		{
+			friend Pool;
+
+			Pool* pool;
+			Entry entry;
+
+			Handle(const Handle&) = delete;
+
+			Handle(Pool* pool, Entry&& entry)
+				: pool(pool),
+				entry(std::move(entry))
+			{
+			}
+
+		public:
+			Handle(Handle&& handle)
+				: pool(handle.pool),
+				entry(std::move(handle.entry))
+			{
+				handle.pool = nullptr;
+			}
+
+			virtual ~Handle()
+			{
+				Release();
+			}
+
+			// Destroys the state instead of returning it to the pool
+			void Discard()
+			{
+				entry.lua.reset();
+				pool = nullptr;
+			}
+
+			void Release()
+			{
+				if (pool)
+				{
+					pool->Release(std::move(entry));
+					pool = nullptr;
+				}
+			}
+
+			operator bool() const
+			{
+				return entry.lua != nullptr;
+			}
+
+			LuaCPP& operator * () const
+			{
+				return *entry.lua;
+			}
+
+			LuaCPP* operator -> () const
+			{
+				return entry.lua.get();
+			}
+
+			auto& operator = (Handle&& handle)
+			{
+				Release();
+
+				pool        = handle.pool;
+				entry       = std::move(handle.entry);
+				handle.pool = nullptr;
+
+				return *this;
+			}
+		};
+
+	private:
+		size_t             size;
+		Initializer        initializer;
+		std::vector<Entry> entries;
+		Stats              stats = {};
+		mutable std::mutex mutex;
+
+		Pool(Pool&&) = delete;
+		Pool(const Pool&) = delete;
+
+	public:
+		// @throw std::exception
+		// @param size number of idle states kept ready
+		Pool(size_t size, Initializer&& initializer)
+			: size(size),
+			initializer(std::move(initializer))
+		{
+			entries.reserve(size);
+
+			for (size_t i = 0; i < size; ++i)
+				entries.push_back(Create());
+		}
+
+		virtual ~Pool()
+		{
+		}
+
+		auto GetSize() const
+		{
+			return size;
+		}
+
+		auto GetStats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			return stats;
+		}
+
+		// @throw std::exception
+		Handle Acquire()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (!entries.empty())
+				{
+					auto entry = std::move(entries.back());
+					entries.pop_back();
+					++stats.hits;
+
+					return Handle(this, std::move(entry));
+				}
+
+				++stats.misses;
+			}
+
+			return Handle(this, Create());
+		}
+
+	private:
+		// @throw std::exception
+		Entry Create()
+		{
+			Entry entry = { std::make_unique<LuaCPP>(), LUA_NOREF };
+
+			if (!*entry.lua)
+				throw Exception("luaL_newstate", "not enough memory");
+
+			initializer(*entry.lua);
+
+			lua_State* lua = *entry.lua;
+
+			lua_settop(lua, 0);
+			lua_pushcfunction(lua, &Pool::Snapshot);
+
+			if (lua_pcall(lua, 0, 1, 0) != LUA_OK)
+				throw Exception("LuaCPP::Pool::Snapshot", lua);
+
+			entry.snapshot = luaL_ref(lua, LUA_REGISTRYINDEX);
+
+			return entry;
+		}
+
+		void  Release(Entry&& entry)
+		{
+			if (!entry.lua || !*entry.lua)
+				return;
+
+			lua_State* lua = *entry.lua;
+
+			auto start      = std::chrono::steady_clock::now();
+			auto hook       = lua_gethook(lua);
+			auto hook_mask  = lua_gethookmask(lua);
+			auto hook_count = lua_gethookcount(lua);
+
+			// budget and profiler hooks stay installed, they are only kept out of the restore itself
+			lua_settop(lua, 0);
+			lua_sethook(lua, nullptr, 0, 0);
+			lua_pushcfunction(lua, &Pool::Restore);
+			lua_pushinteger(lua, entry.snapshot);
+
+			bool is_restored = lua_pcall(lua, 1, 0, 0) == LUA_OK;
+			auto time        = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+			lua_sethook(lua, hook, hook_mask, hook_count);
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!is_restored)
+			{
+				++stats.resets_failed;
+
+				return;
+			}
+
+			++stats.resets;
+			stats.reset_time += time;
+
+			if (time > stats.reset_time_max)
+				stats.reset_time_max = time;
+
+			if (entries.size() < size)
+				entries.push_back(std::move(entry));
+		}
+
+	private:
+		// @return snapshot table mapping each tracked table to a shallow copy
+		static int  Snapshot(lua_State* lua)
+		{
+			lua_newtable(lua);
+			lua_pushglobaltable(lua);
+			SnapshotTable(lua, 1, 2, false);
+
+			lua_pushnil(lua);
+
+			while (lua_next(lua, 2))
+			{
+				if (lua_istable(lua, -1))
+					SnapshotTable(lua, 1, -1, false);
+
+				lua_pop(lua, 1);
+			}
+
+			if (lua_getfield(lua, LUA_REGISTRYINDEX, LUA_LOADED_TABLE) == LUA_TTABLE)
+				SnapshotTable(lua, 1, -1, false);
+
+			// integer keys belong to luaL_ref and are left untouched
+			lua_pushvalue(lua, LUA_REGISTRYINDEX);
+			SnapshotTable(lua, 1, -1, true);
+
+			lua_settop(lua, 1);
+
+			return 1;
+		}
+		static void SnapshotTable(lua_State* lua, int snapshots, int table, bool skip_integer_keys)
+		{
+			table = lua_absindex(lua, table);
+
+			lua_pushvalue(lua, table);
+
+			if (lua_rawget(lua, snapshots) != LUA_TNIL)
+			{
+				lua_pop(lua, 1);
+
+				return;
+			}
+
+			lua_pop(lua, 1);
+			lua_newtable(lua);
+			lua_pushnil(lua);
+
+			while (lua_next(lua, table))
+			{
+				if (skip_integer_keys && lua_isinteger(lua, -2))
+				{
+					lua_pop(lua, 1);
+
+					continue;
+				}
+
+				lua_pushvalue(lua, -2);
+				lua_insert(lua, -2);
+				lua_rawset(lua, -4);
+			}
+
+			lua_pushvalue(lua, table);
+			lua_insert(lua, -2);
+			lua_rawset(lua, snapshots);
+		}
+
+		static int  Restore(lua_State* lua)
+		{
+			lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_tointeger(lua, 1));
+			lua_pushnil(lua);
+
+			while (lua_next(lua, 2))
+			{
+				bool is_registry = lua_rawequal(lua, -2, LUA_REGISTRYINDEX) != 0;
+
+				RestoreTable(lua, lua_absindex(lua, -2), lua_absindex(lua, -1), is_registry);
+				lua_pop(lua, 1);
+			}
+
+			return 0;
+		}
+		static void RestoreTable(lua_State* lua, int table, int snapshot, bool skip_integer_keys)
+		{
+			lua_pushnil(lua);
+
+			while (lua_next(lua, table))
+			{
+				if (!skip_integer_keys || !lua_isinteger(lua, -2))
+				{
+					lua_pushvalue(lua, -2);
+
+					if (lua_rawget(lua, snapshot) == LUA_TNIL)
+					{
+						lua_pushvalue(lua, -3);
+						lua_pushnil(lua);
+						lua_rawset(lua, table);
+					}
+
+					lua_pop(lua, 1);
+				}
+
+				lua_pop(lua, 1);
+			}
+
+			lua_pushnil(lua);
+
+			while (lua_next(lua, snapshot))
+			{
+				lua_pushvalue(lua, -2);
+				lua_insert(lua, -2);
+				lua_rawset(lua, table);
+			}
+		}
+	};
+
+	// Runs jobs on a fixed set of worker threads, each owning one state.
+	// Every worker has its own job queue, idle workers steal from the others.
+	// Jobs submitted from inside a job stay on the submitting worker.
+	class Executor
+	{
+	public:
+		typedef std::function<void(LuaCPP& lua)> Initializer;
+
+	private:
+		typedef std::function<void(LuaCPP& lua)> Job;
+
+		struct Worker
+		{
+			std::thread             thread;
+			std::deque<Job>         jobs;
+			std::mutex              jobs_mutex;
+			std::unique_ptr<LuaCPP> lua;
+		};
+
+		struct Context
+		{
+			Executor* executor;
+			size_t    worker;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::atomic<size_t>                  workers_next     = 0;
+		std::atomic<size_t>                  workers_sleeping = 0;
+		std::atomic<size_t>                  jobs_pending     = 0;
+		std::atomic<bool>                    is_stopping      = false;
+		std::mutex                           sleep_mutex;
+		std::condition_variable              sleep_condition;
+
+		Executor(Executor&&) = delete;
+		Executor(const Executor&) = delete;
+
+	public:
+		// @throw std::exception
+		// @param pin_threads pin worker i to cpu i (linux only)
+		Executor(size_t thread_count, const Initializer& initializer, bool pin_threads = false)
+		{
+			assert(thread_count != 0);
+
+			std::vector<std::future<void>> workers_ready;
+
+			workers.reserve(thread_count);
+			workers_ready.reserve(thread_count);
+
+			for (size_t i = 0; i < thread_count; ++i)
+				workers.push_back(std::make_unique<Worker>());
+
+			// workers already started are stopped and joined if a later one fails to start or initialize
+			try
+			{
+				for (size_t i = 0; i < thread_count; ++i)
+				{
+					auto ready = std::make_shared<std::promise<void>>();
+
+					workers_ready.push_back(ready->get_future());
+					workers[i]->thread = std::thread([this, i, ready, &initializer, pin_threads]()
+					{
+						try
+						{
+							if (pin_threads)
+								PinThread(i);
+
+							workers[i]->lua = std::make_unique<LuaCPP>();
+
+							if (!*workers[i]->lua)
+								throw Exception("luaL_newstate", "not enough memory");
+
+							initializer(*workers[i]->lua);
+							lua_settop(*workers[i]->lua, 0);
+						}
+						catch (...)
+						{
+							ready->set_exception(std::current_exception());
+
+							return;
+						}
+
+						ready->set_value();
+
+						WorkerMain(i);
+					});
+				}
+
+				for (auto& worker_ready : workers_ready)
+					worker_ready.get();
+			}
+			catch (...)
+			{
+				Stop();
+
+				throw;
+			}
+		}
+
+		virtual ~Executor()
+		{
+			Stop();
+		}
+
+		auto GetThreadCount() const
+		{
+			return workers.size();
+		}
+
+		// @param function callable invoked as function(LuaCPP&) on a worker thread
+		template<typename F>
+		auto Submit(F&& function)
+		{
+			typedef std::invoke_result_t<F, LuaCPP&> T;
+
+			auto task   = std::make_shared<std::packaged_task<T(LuaCPP&)>>(std::forward<F>(function));
+			auto result = task->get_future();
+
+			Enqueue([task](LuaCPP& lua) { (*task)(lua); });
+
+			return result;
+		}
+
+		auto Run(std::string lua)
+		{
+			return Submit([lua = std::move(lua)](LuaCPP& state) { state.Run(lua); });
+		}
+
+		auto RunFile(std::string path)
+		{
+			return Submit([path = std::move(path)](LuaCPP& state) { return state.RunFile(path); });
+		}
+
+		// Calls a global function of whichever worker state picks up the job
+		template<typename T, typename ... TArgs>
+		auto Call(std::string name, TArgs ... args)
+		{
+			return Submit([name = std::move(name), args = std::make_tuple(std::move(args) ...)](LuaCPP& state)->T
+			{
+				lua_State* lua = state;
+
+				if (int type = lua_getglobal(lua, name.c_str()); type != LUA_TFUNCTION)
+				{
+					lua_pop(lua, 1);
+
+					throw Exception("lua_getglobal", type);
+				}
+
+				auto arg_count    = std::apply([lua](const auto& ... args) { return (0 + ... + LuaCPP::Push(lua, args)); }, args);
+				auto result_count = std::is_same<T, void>::value ? 0 : 1;
+
+				if (lua_pcall(lua, arg_count, result_count, 0) != LUA_OK)
+					throw Exception("lua_pcall", lua);
+
+				if constexpr (!std::is_same<T, void>::value)
+				{
+					T value;
+
+					if (!LuaCPP::Pop(lua, value))
+					{
+						lua_pop(lua, 1);
+
+						throw Exception("LuaCPP::Executor::Call", "Error popping return value");
+					}
+
+					return value;
+				}
+			});
+		}
+
+	private:
+		void Enqueue(Job&& job)
+		{
+			auto  context = GetContext();
+			auto& worker  = *workers[(context.executor == this) ? context.worker : (workers_next++ % workers.size())];
+
+			// counted before it becomes visible, a thief decrements as soon as it takes it
+			++jobs_pending;
+
+			try
+			{
+				std::lock_guard<std::mutex> lock(worker.jobs_mutex);
+
+				worker.jobs.push_back(std::move(job));
+			}
+			catch (...)
+			{
+				--jobs_pending;
+
+				throw;
+			}
+
+			if (workers_sleeping > 0)
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+
+				sleep_condition.notify_one();
+			}
+		}
+
+		bool Dequeue(size_t index, Job& job)
+		{
+			for (size_t i = 0; i < workers.size(); ++i)
+			{
+				auto& worker = *workers[(index + i) % workers.size()];
+
+				std::lock_guard<std::mutex> lock(worker.jobs_mutex);
+
+				if (worker.jobs.empty())
+					continue;
+
+				// own queue is lifo for cache locality, stealing is fifo
+				if (i == 0)
+				{
+					job = std::move(worker.jobs.back());
+					worker.jobs.pop_back();
+				}
+				else
+				{
+					job = std::move(worker.jobs.front());
+					worker.jobs.pop_front();
+				}
+
+				--jobs_pending;
+
+				return true;
+			}
+
+			return false;
+		}
+
+		void WorkerMain(size_t index)
+		{
+			auto& lua = *workers[index]->lua;
+
+			GetContext() = { this, index };
+
+			for (Job job;;)
+			{
+				if (Dequeue(index, job))
+				{
+					job(lua);
+					job = nullptr;
+					lua_settop(lua, 0);
+
+					continue;
+				}
+
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+
+				++workers_sleeping;
+				sleep_condition.wait(lock, [this]() { return (jobs_pending > 0) || is_stopping; });
+				--workers_sleeping;
+
+				if (is_stopping && (jobs_pending == 0))
+					break;
+			}
+
+			GetContext() = {};
+		}
+
+		void Stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+
+				is_stopping = true;
+				sleep_condition.notify_all();
+			}
+
+			for (auto& worker : workers)
+				if (worker->thread.joinable())
+					worker->thread.join();
+
+			workers.clear();
+		}
+
+		static void PinThread(size_t index)
+		{
+#if defined(__linux__)
+			auto cpu_count = std::thread::hardware_concurrency();
+
+			// 0 when the count is unknown
+			if (cpu_count == 0)
+				return;
+
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(index % cpu_count, &cpu_set);
+
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+#endif
+		}
+
+		static Context& GetContext()
+		{
+			static thread_local Context context = {};
+
+			return context;
+		}
+	};
+
+#if defined(__linux__)
+	// Single-threaded scheduler running many scripts as coroutines of one state.
+	// Scripts park themselves with sleep(seconds) and wait_readable(fd[, timeout])
+	// and are resumed from an epoll loop, timeouts live in a hierarchical timer wheel.
+	// Must be destroyed before the state it runs on.
+	class Scheduler
+	{
+		friend Channel;
+
+	public:
+		struct Stats
+		{
+			size_t                   resumes;
+			size_t                   timers_fired;
+			size_t                   io_events;
+			// delay between a coroutine becoming ready and it being resumed
+			std::chrono::nanoseconds latency;
+			std::chrono::nanoseconds latency_max;
+			// [i] counts resumes delayed by less than 2^i microseconds, the last bucket takes the rest
+			std::array<size_t, 16>   latency_histogram;
+		};
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		static constexpr size_t WHEEL_BITS   = 6;
+		static constexpr size_t WHEEL_SLOTS  = size_t(1) << WHEEL_BITS;
+		static constexpr size_t WHEEL_LEVELS = 4;
+		static constexpr size_t EVENT_COUNT  = 64;
+
+		// address is the registry key of the scheduler running coroutines of a state
+		static constexpr char KEY = 0;
+
+		enum class Waits
+		{
+			None,
+			Timer,
+			Readable
+		};
+
+		struct Task;
+
+		// intrusive, heads of the wheel slots are sentinels
+		struct Timer
+		{
+			Timer*   next;
+			Timer*   prev;
+			Task*    task;
+			uint64_t expiry;
+		};
+
+		struct Task
+		{
+			Thread            thread;
+			Timer             timer;
+			Waits             wait;
+			int               fd;
+			bool              owns_fd;
+			bool              parked;
+			bool              readable;
+			Clock::time_point ready_time;
+		};
+
+		LuaCPP&                                       lua;
+		int                                           epoll;
+		bool                                          stopped;
+		Clock::duration                               tick;
+		Clock::time_point                             origin;
+		uint64_t                                      tick_now;
+		size_t                                        timer_count;
+		size_t                                        io_count;
+		std::array<Timer, WHEEL_SLOTS * WHEEL_LEVELS> wheel;
+		std::unordered_map<lua_State*, Task>          tasks;
+		std::vector<Task*>                            ready;
+		std::vector<Task*>                            running;
+		Stats                                         stats;
+
+		Scheduler(const Scheduler&) = delete;
+		Scheduler(Scheduler&&) = delete;
+
+	public:
+		// Registers sleep and wait_readable as globals, they find the scheduler through
+		// the registry and raise an error once it is destroyed
+		// @param tick timer resolution
+		// @throw std::exception
+		Scheduler(LuaCPP& lua, Clock::duration tick = std::chrono::milliseconds(1))
+			: lua(lua),
+			epoll(epoll_create1(EPOLL_CLOEXEC)),
+			stopped(false),
+			tick(tick),
+			origin(Clock::now()),
+			tick_now(0),
+			timer_count(0),
+			io_count(0),
+			stats()
+		{
+			if (epoll == -1)
+				throw Exception("epoll_create1", errno);
+
+			for (auto& head : wheel)
+				head.next = head.prev = &head;
+
+			lua_pushcfunction(lua, &Scheduler::Sleep);
+			lua_setglobal(lua, "sleep");
+			lua_pushcfunction(lua, &Scheduler::WaitReadable);
+			lua_setglobal(lua, "wait_readable");
+			lua_pushlightuserdata(lua, this);
+			lua_rawsetp(lua, LUA_REGISTRYINDEX, &KEY);
+		}
+
+		virtual ~Scheduler()
+		{
+			if (Get(lua) == this)
+			{
+				lua_pushnil(lua);
+				lua_rawsetp(lua, LUA_REGISTRYINDEX, &KEY);
+			}
+
+			tasks.clear();
+
+			close(epoll);
+		}
+
+		size_t GetTaskCount() const
+		{
+			return tasks.size();
+		}
+
+		constexpr const Stats& GetStats() const
+		{
+			return stats;
+		}
+
+		void ResetStats()
+		{
+			stats = {};
+		}
+
+		// Starts a coroutine running the global function, it runs until it first parks or returns
+		// @throw std::exception
+		template<typename ... TArgs>
+		void Spawn(std::string_view function, TArgs&& ... args)
+		{
+			auto thread = lua.CreateThread(function);
+			auto state  = thread.GetState();
+			auto& task  = tasks.try_emplace(state, Task { .thread = std::move(thread), .timer = {}, .wait = Waits::None, .fd = -1, .owns_fd = false, .parked = false, .readable = false }).first->second;
+
+			task.timer.task = &task;
+			task.ready_time = Clock::now();
+
+			Step(task, std::forward<TArgs>(args) ...);
+		}
+
+		// Runs until every coroutine returned or Stop is called
+		// @throw std::exception on script errors, the failing coroutine is dropped
+		void Run()
+		{
+			for (stopped = false; !stopped && RunOnce(); )
+			{
+			}
+		}
+
+		// Waits for the next timer or fd event and resumes everything that became ready
+		// @return false if nothing is left to wait for
+		// @throw std::exception
+		bool RunOnce()
+		{
+			int timeout = 0;
+
+			if (ready.empty())
+			{
+				if (timer_count != 0)
+				{
+					auto delay = std::chrono::ceil<std::chrono::milliseconds>(GetTickTime(tick_now + GetNextTimer()) - Clock::now());
+
+					timeout = static_cast<int>((delay.count() > 0) ? delay.count() : 0);
+				}
+				else if (io_count != 0)
+					timeout = -1;
+				else
+					return false;
+			}
+
+			epoll_event events[EVENT_COUNT];
+
+			int event_count = epoll_wait(epoll, events, static_cast<int>(EVENT_COUNT), timeout);
+
+			if ((event_count == -1) && (errno != EINTR))
+				throw Exception("epoll_wait", errno);
+
+			auto now = Clock::now();
+
+			for (int i = 0; i < event_count; ++i)
+			{
+				auto task = static_cast<Task*>(events[i].data.ptr);
+
+				Unwatch(*task);
+				Disarm(*task);
+
+				task->readable = true;
+
+				Wake(*task, now);
+
+				++stats.io_events;
+			}
+
+			Advance(static_cast<uint64_t>((now - origin) / tick));
+
+			// coroutines readied while these run wait for the next round
+			running.swap(ready);
+
+			for (size_t i = 0; i < running.size(); ++i)
+			{
+				try
+				{
+					Step(*running[i]);
+				}
+				catch (...)
+				{
+					ready.insert(ready.begin(), running.begin() + i + 1, running.end());
+					running.clear();
+
+					throw;
+				}
+			}
+
+			running.clear();
+
+			return true;
+		}
+
+		void Stop()
+		{
+			stopped = true;
+		}
+
+	private:
+		// @throw std::exception
+		template<typename ... TArgs>
+		void Step(Task& task, TArgs&& ... args)
+		{
+			auto now     = Clock::now();
+			auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - task.ready_time);
+			auto bucket  = std::bit_width(static_cast<uint64_t>(latency.count() / 1000));
+
+			stats.resumes++;
+			stats.latency += latency;
+			stats.latency_max = (std::max)(stats.latency_max, latency);
+			stats.latency_histogram[(bucket < stats.latency_histogram.size()) ? bucket : (stats.latency_histogram.size() - 1)]++;
+
+			auto wait   = task.wait;
+			task.wait   = Waits::None;
+			task.parked = false;
+
+			bool yielded;
+
+			try
+			{
+				if constexpr (sizeof...(TArgs) != 0)
+					yielded = task.thread.Resume(std::forward<TArgs>(args) ...);
+				else if (wait == Waits::Readable)
+					yielded = task.thread.Resume(task.readable);
+				else
+					yielded = task.thread.Resume();
+			}
+			catch (...)
+			{
+				Drop(task);
+
+				throw;
+			}
+
+			if (!yielded)
+				Drop(task);
+			// plain coroutine.yield gives way to the others
+			else if (!task.parked)
+				Wake(task, now);
+		}
+
+		void Drop(Task& task)
+		{
+			Unwatch(task);
+			Disarm(task);
+
+			tasks.erase(task.thread.GetState());
+		}
+
+		void Wake(Task& task, Clock::time_point ready_time)
+		{
+			task.ready_time = ready_time;
+
+			ready.push_back(&task);
+		}
+
+		// @return nullptr if no scheduler was created on the state
+		static Scheduler* Get(lua_State* lua)
+		{
+			lua_rawgetp(lua, LUA_REGISTRYINDEX, &KEY);
+			auto scheduler = static_cast<Scheduler*>(lua_touserdata(lua, -1));
+			lua_pop(lua, 1);
+
+			return scheduler;
+		}
+
+		// @return nullptr if the coroutine was not started by this scheduler
+		Task* GetRunningTask(lua_State* lua)
+		{
+			if (!lua_isyieldable(lua))
+				return nullptr;
+
+			auto it = tasks.find(lua);
+
+			return (it != tasks.end()) ? &it->second : nullptr;
+		}
+
+		void Arm(Task& task, Clock::time_point deadline)
+		{
+			auto expiry = static_cast<uint64_t>((deadline - origin + tick - Clock::duration(1)) / tick);
+
+			task.timer.expiry = (std::max)(expiry, tick_now + 1);
+
+			Insert(task.timer);
+
+			++timer_count;
+		}
+
+		void Disarm(Task& task)
+		{
+			if (task.timer.next != nullptr)
+			{
+				Unlink(task.timer);
+
+				--timer_count;
+			}
+		}
+
+		void Unwatch(Task& task)
+		{
+			if (task.fd != -1)
+			{
+				epoll_ctl(epoll, EPOLL_CTL_DEL, task.fd, nullptr);
+
+				if (task.owns_fd)
+					close(task.fd);
+
+				task.fd      = -1;
+				task.owns_fd = false;
+				--io_count;
+			}
+		}
+
+		void Insert(Timer& timer)
+		{
+			constexpr uint64_t RANGE = uint64_t(1) << (WHEEL_BITS * WHEEL_LEVELS);
+
+			// beyond the wheel, park in the top level until a cascade brings it closer
+			auto   expiry = (std::min)(timer.expiry, tick_now + RANGE - 1);
+			auto   delta  = expiry - tick_now;
+			size_t level  = 0;
+
+			while ((level + 1 < WHEEL_LEVELS) && (delta >= (uint64_t(1) << (WHEEL_BITS * (level + 1)))))
+				++level;
+
+			auto& head = wheel[level * WHEEL_SLOTS + ((expiry >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1))];
+
+			timer.next      = head.next;
+			timer.prev      = &head;
+			head.next->prev = &timer;
+			head.next       = &timer;
+		}
+
+		static void Unlink(Timer& timer)
+		{
+			timer.prev->next = timer.next;
+			timer.next->prev = timer.prev;
+			timer.next       = nullptr;
+			timer.prev       = nullptr;
+		}
+
+		Clock::time_point GetTickTime(uint64_t tick_index) const
+		{
+			return origin + static_cast<Clock::rep>(tick_index) * tick;
+		}
+
+		// @return ticks until the next timer fires or the wheel has to cascade
+		uint64_t GetNextTimer() const
+		{
+			// the cascade at the level 0 wrap may bring in timers due before anything in the slots past it
+			auto cascade = WHEEL_SLOTS - (tick_now & (WHEEL_SLOTS - 1));
+
+			for (uint64_t i = 1; i < cascade; ++i)
+				if (auto& head = wheel[(tick_now + i) & (WHEEL_SLOTS - 1)]; head.next != &head)
+					return i;
+
+			return cascade;
+		}
+
+		void Advance(uint64_t tick_target)
+		{
+			if (timer_count == 0)
+			{
+				tick_now = (std::max)(tick_now, tick_target);
+
+				return;
+			}
+
+			while (tick_now < tick_target)
+			{
+				++tick_now;
+
+				// refill the lower levels whenever one of them wraps around
+				for (size_t level = 1; level < WHEEL_LEVELS; ++level)
+				{
+					if ((tick_now & ((uint64_t(1) << (WHEEL_BITS * level)) - 1)) != 0)
+						break;
+
+					auto& head = wheel[level * WHEEL_SLOTS + ((tick_now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1))];
+
+					for (auto timer = head.next; timer != &head; )
+					{
+						auto next = timer->next;
+
+						Insert(*timer);
+
+						timer = next;
+					}
+
+					head.next = head.prev = &head;
+				}
+
+				auto& head = wheel[tick_now & (WHEEL_SLOTS - 1)];
+
+				while (head.next != &head)
+				{
+					auto& task = *head.next->task;
+
+					Unlink(task.timer);
+					Unwatch(task);
+
+					--timer_count;
+					task.readable = false;
+
+					Wake(task, GetTickTime(tick_now));
+
+					++stats.timers_fired;
+				}
+			}
+		}
+
+		static int  Sleep(lua_State* lua)
+		{
+			auto scheduler = Get(lua);
+			auto seconds   = luaL_checknumber(lua, 1);
+			auto task      = (scheduler != nullptr) ? scheduler->GetRunningTask(lua) : nullptr;
+
+			if (task == nullptr)
+				return luaL_error(lua, "sleep called outside a scheduled coroutine");
+
+			scheduler->Arm(*task, Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<lua_Number>(seconds)));
+
+			task->wait   = Waits::Timer;
+			task->parked = true;
+
+			return LuaCPP::Yield(lua, 0);
+		}
+
+		// Resumes with true once fd is readable, false on timeout
+		static int  WaitReadable(lua_State* lua)
+		{
+			auto scheduler = Get(lua);
+			auto fd        = static_cast<int>(luaL_checkinteger(lua, 1));
+			auto timeout   = luaL_optnumber(lua, 2, -1);
+			auto task      = (scheduler != nullptr) ? scheduler->GetRunningTask(lua) : nullptr;
+
+			if (task == nullptr)
+				return luaL_error(lua, "wait_readable called outside a scheduled coroutine");
+
+			if (!scheduler->ParkReadable(*task, fd, timeout))
+				return luaL_error(lua, "epoll_ctl: %s", strerror(errno));
+
+			return LuaCPP::Yield(lua, 0);
+		}
+
+		// Parks the task until fd is readable, the caller has to yield right after.
+		// Any number of coroutines may wait on the same fd, all of them are woken.
+		// @param timeout seconds, negative waits forever
+		// @return false if epoll_ctl failed
+		bool ParkReadable(Task& task, int fd, lua_Number timeout)
+		{
+			epoll_event event = {};
+			event.events      = EPOLLIN;
+			event.data.ptr    = &task;
+
+			bool owns_fd = false;
+
+			if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1)
+			{
+				// epoll keeps one registration per descriptor, further waiters watch a duplicate
+				if ((errno != EEXIST) || ((fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1))
+					return false;
+
+				if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1)
+				{
+					auto error = errno;
+
+					close(fd);
+					errno = error;
+
+					return false;
+				}
+
+				owns_fd = true;
+			}
+
+			task.fd      = fd;
+			task.owns_fd = owns_fd;
+			++io_count;
+
+			if (timeout >= 0)
+				Arm(task, Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<lua_Number>(timeout)));
+
+			task.wait   = Waits::Readable;
+			task.parked = true;
+
+			return true;
+		}
+	};
+#endif
+
+#if defined(__linux__)
+	// Bounded queue moving values between states on different threads, any number of senders and
+	// one receiver at a time. Values travel as Serializer bytes in buffers owned by the slots, a
+	// send swaps its buffer with the slot's so both sides reuse capacity instead of allocating.
+	// Copies share the queue, Push hands scripts a userdata with send, recv and try_recv.
+	class Channel
+	{
+		friend LuaCPP;
+
+		// Vyukov style ring, a slot is writable when sequence == position and readable when sequence == position + 1
+		struct alignas(64) Slot
+		{
+			std::atomic<size_t>  sequence;
+			std::vector<uint8_t> buffer;
+		};
+
+		struct Queue
+		{
+			std::unique_ptr<Slot[]> slots;
+			size_t                  mask;
+			bool                    single_producer;
+			int                     event;
+			std::atomic<bool>       receiver_waiting;
+
+			alignas(64) std::atomic<size_t> tail;
+			// only touched by the receiver
+			alignas(64) size_t              head;
+
+			Queue(size_t capacity, bool single_producer)
+				: slots(new Slot[capacity]),
+				mask(capacity - 1),
+				single_producer(single_producer),
+				event(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+				receiver_waiting(false),
+				tail(0),
+				head(0)
+			{
+				if (event == -1)
+					throw Exception("eventfd", errno);
+
+				for (size_t i = 0; i < capacity; ++i)
+					slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+
+			~Queue()
+			{
+				close(event);
+			}
+
+			// Swaps buffer into a free slot
+			// @return false if full
+			bool Enqueue(std::vector<uint8_t>& buffer)
+			{
+				auto  position = tail.load(std::memory_order_relaxed);
+				Slot* slot;
+
+				for (;;)
+				{
+					slot = &slots[position & mask];
+
+					auto difference = static_cast<intptr_t>(slot->sequence.load(std::memory_order_acquire) - position);
+
+					if (difference < 0)
+						return false;
+
+					if (difference > 0)
+						position = tail.load(std::memory_order_relaxed);
+					else if (single_producer)
+					{
+						tail.store(position + 1, std::memory_order_relaxed);
+
+						break;
+					}
+					else if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						break;
+				}
+
+				slot->buffer.swap(buffer);
+				slot->sequence.store(position + 1, std::memory_order_release);
+
+				// pairs with the fence in BeginWait so either the receiver sees the value or we see it waiting
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				if (receiver_waiting.load(std::memory_order_relaxed) && receiver_waiting.exchange(false))
+				{
+					uint64_t count = 1;
+
+					[[maybe_unused]] auto result = write(event, &count, sizeof(count));
+				}
+
+				return true;
+			}
+
+			// Swaps the oldest value into buffer
+			// @return false if empty
+			bool Dequeue(std::vector<uint8_t>& buffer)
+			{
+				auto& slot = slots[head & mask];
+
+				if (slot.sequence.load(std::memory_order_acquire) != (head + 1))
+					return false;
+
+				slot.buffer.swap(buffer);
+				slot.sequence.store(head + mask + 1, std::memory_order_release);
+				++head;
+
+				return true;
+			}
+
+			bool IsEmpty() const
+			{
+				return slots[head & mask].sequence.load(std::memory_order_acquire) != (head + 1);
+			}
+
+			// @return false if a value arrived meanwhile, otherwise event becomes readable on the next send
+			bool BeginWait()
+			{
+				receiver_waiting.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				if (!IsEmpty())
+				{
+					receiver_waiting.store(false, std::memory_order_relaxed);
+
+					return false;
+				}
+
+				return true;
+			}
+
+			// Blocks until event is readable
+			// @param timeout milliseconds, negative waits forever
+			void Wait(int timeout) const
+			{
+				pollfd descriptor = { .fd = event, .events = POLLIN, .revents = 0 };
+
+				while ((poll(&descriptor, 1, timeout) == -1) && (errno == EINTR))
+				{
+				}
+			}
+
+			void EndWait()
+			{
+				uint64_t count;
+
+				receiver_waiting.store(false, std::memory_order_relaxed);
+
+				[[maybe_unused]] auto result = read(event, &count, sizeof(count));
+			}
+		};
+
+		struct Block
+		{
+			const void*            type;
+			std::shared_ptr<Queue> queue;
+		};
+
+		// address is used as the registry key of the metatable
+		static constexpr char TYPE_ID = 0;
+
+		std::shared_ptr<Queue> queue;
+
+	public:
+		// @param capacity rounded up to a power of two
+		// @param single_producer skips the compare and swap when only one thread ever sends
+		// @throw std::exception
+		explicit Channel(size_t capacity, bool single_producer = false)
+			: queue(std::make_shared<Queue>(std::bit_ceil((std::max)(capacity, size_t(1))), single_producer))
+		{
+		}
+
+		size_t GetCapacity() const
+		{
+			return queue->mask + 1;
+		}
+
+		// @throw std::exception if the Serializer rejects the value
+		// @return false if full
+		bool TrySend(lua_State* lua, int index) const
+		{
+			auto& buffer = GetBuffer();
+
+			Serializer::Serialize(lua, index, buffer);
+
+			return queue->Enqueue(buffer);
+		}
+
+		// Pushes the value, receivers must not run concurrently
+		// @throw std::exception
+		// @return false if empty
+		bool TryReceive(lua_State* lua) const
+		{
+			auto& buffer = GetBuffer();
+
+			if (!queue->Dequeue(buffer))
+				return false;
+
+			Serializer::Deserialize(lua, buffer);
+
+			return true;
+		}
+
+		// Blocks the calling thread until a value arrives and pushes it
+		// @param timeout negative waits forever
+		// @throw std::exception
+		// @return false on timeout
+		bool Receive(lua_State* lua, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1)) const
+		{
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+
+			while (!TryReceive(lua))
+			{
+				int remaining = -1;
+
+				if (timeout.count() >= 0)
+				{
+					remaining = static_cast<int>((std::max)(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count(), std::chrono::milliseconds::rep(0)));
+
+					if ((remaining == 0) && queue->IsEmpty())
+						return false;
+				}
+
+				if (queue->BeginWait())
+				{
+					queue->Wait(remaining);
+					queue->EndWait();
+				}
+			}
+
+			return true;
+		}
+
+	private:
+		explicit Channel(std::shared_ptr<Queue> queue)
+			: queue(std::move(queue))
+		{
+		}
+
+		void PushValue(lua_State* lua) const
+		{
+			auto block = static_cast<Block*>(lua_newuserdatauv(lua, sizeof(Block), 0));
+
+			new (block) Block { .type = &TYPE_ID, .queue = queue };
+
+			PushMetatable(lua);
+			lua_setmetatable(lua, -2);
+		}
+
+		// per thread scratch, the buffer swapped out of a slot comes back here for the next call
+		static std::vector<uint8_t>& GetBuffer()
+		{
+			static thread_local std::vector<uint8_t> buffer;
+
+			return buffer;
+		}
+
+		static Block* ToBlock(lua_State* lua, int index)
+		{
+			auto block = reinterpret_cast<Block*>(lua_touserdata(lua, index));
+
+			if ((block == nullptr) || (lua_rawlen(lua, index) != sizeof(Block)) || (block->type != &TYPE_ID))
+				luaL_typeerror(lua, index, "LuaCPP::Channel");
+
+			return block;
+		}
+
+		static void PushMetatable(lua_State* lua)
+		{
+			if (lua_rawgetp(lua, LUA_REGISTRYINDEX, &TYPE_ID) == LUA_TTABLE)
+				return;
+
+			lua_pop(lua, 1);
+			lua_createtable(lua, 0, 3);
+			lua_createtable(lua, 0, 3);
+			lua_pushcfunction(lua, &Channel::ScriptSend);
+			lua_setfield(lua, -2, "send");
+			lua_pushcfunction(lua, &Channel::ScriptReceive);
+			lua_setfield(lua, -2, "recv");
+			lua_pushcfunction(lua, &Channel::ScriptTryReceive);
+			lua_setfield(lua, -2, "try_recv");
+			lua_setfield(lua, -2, "__index");
+			lua_pushcfunction(lua, &Channel::Collect);
+			lua_setfield(lua, -2, "__gc");
+			lua_pushliteral(lua, "LuaCPP::Channel");
+			lua_setfield(lua, -2, "__name");
+			lua_pushvalue(lua, -1);
+			lua_rawsetp(lua, LUA_REGISTRYINDEX, &TYPE_ID);
+		}
+
+		static int  Collect(lua_State* lua)
+		{
+			ToBlock(lua, 1)->~Block();
+
+			return 0;
+		}
+
+		// channel:send(value) returns false instead of blocking when full
+		static int  ScriptSend(lua_State* lua)
+		{
+			auto block = ToBlock(lua, 1);
+			char error[256];
+			bool sent  = false;
+
+			lua_settop(lua, 2);
+			error[0] = '\0';
+
+			// luaL_error must not unwind through live C++ objects
+			try
+			{
+				auto& buffer = GetBuffer();
+
+				Serializer::Serialize(lua, 2, buffer);
+
+				sent = block->queue->Enqueue(buffer);
+			}
+			catch (const std::exception& exception)
+			{
+				std::strncpy(error, exception.what(), sizeof(error) - 1);
+				error[sizeof(error) - 1] = '\0';
+			}
+
+			if (error[0] != '\0')
+				return luaL_error(lua, "%s", error);
+
+			lua_pushboolean(lua, sent);
+
+			return 1;
+		}
+
+		// channel:try_recv() returns true and the value, or false if empty
+		static int  ScriptTryReceive(lua_State* lua)
+		{
+			auto block = ToBlock(lua, 1);
+
+			lua_settop(lua, 1);
+			lua_pushboolean(lua, true);
+
+			if (ReceiveValue(lua, block->queue.get()))
+				return 2;
+
+			lua_pushboolean(lua, false);
+
+			return 1;
+		}
+
+		// channel:recv() parks inside coroutines run by the Scheduler of the state and blocks the thread elsewhere
+		static int  ScriptReceive(lua_State* lua)
+		{
+			auto block = ToBlock(lua, 1);
+
+			lua_settop(lua, 1);
+
+			return ContinueReceive(lua, LUA_OK, reinterpret_cast<lua_KContext>(block->queue.get()));
+		}
+		// also the continuation once parked, self at 1 keeps the queue alive
+		static int  ContinueReceive(lua_State* lua, int status, lua_KContext context)
+		{
+			auto queue = reinterpret_cast<Queue*>(context);
+
+			if (lua_gettop(lua) > 1)
+			{
+				lua_settop(lua, 1);
+				queue->EndWait();
+			}
+
+			for (;;)
+			{
+				if (ReceiveValue(lua, queue))
+					return 1;
+
+				if (!queue->BeginWait())
+					continue;
+
+				// only a coroutine the scheduler of this state is running may park
+				if (auto scheduler = Scheduler::Get(lua))
+					if (auto task = scheduler->GetRunningTask(lua); (task != nullptr) && scheduler->ParkReadable(*task, queue->event, -1))
+						return lua_yieldk(lua, 0, context, &Channel::ContinueReceive);
+
+				queue->Wait(-1);
+				queue->EndWait();
+			}
+		}
+
+		// Pushes the value
+		// @return false if empty
+		static bool ReceiveValue(lua_State* lua, Queue* queue)
+		{
+			char error[256];
+
+			try
+			{
+				auto& buffer = GetBuffer();
+
+				if (!queue->Dequeue(buffer))
+					return false;
+
+				Serializer::Deserialize(lua, buffer);
+
+				return true;
+			}
+			catch (const std::exception& exception)
+			{
+				std::strncpy(error, exception.what(), sizeof(error) - 1);
+				error[sizeof(error) - 1] = '\0';
+			}
+
+			luaL_error(lua, "%s", error);
+
+			return false;
+		}
+	};
+#endif
+
+	struct ChunkCacheStats
+	{
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+	};
+
+	// Collected by StepGC and StepGCFor, full collections and steps the collector
+	// takes on its own while allocating are not counted
+	struct GCStats
+	{
+		size_t                   steps;
+		size_t                   cycles;
+		size_t                   bytes_reclaimed;
+		size_t                   last_bytes_reclaimed;
+		std::chrono::nanoseconds step_time;
+		std::chrono::nanoseconds step_time_max;
+		std::chrono::nanoseconds last_step_time;
+	};
+
+	// Stops the collector for its lifetime, e.g. around a request, and restarts it only if
+	// it was running before so scopes nest. StepGC still works while stopped.
+	class GCStopScope
+	{
+		lua_State* lua;
+		bool       was_running;
+
+		GCStopScope(const GCStopScope&) = delete;
+
+	public:
+		explicit GCStopScope(lua_State* lua)
+			: lua(lua),
+			was_running(lua_gc(lua, LUA_GCISRUNNING) != 0)
+		{
+			lua_gc(lua, LUA_GCSTOP);
+		}
+
+		~GCStopScope()
+		{
+			if (was_running)
+				lua_gc(lua, LUA_GCRESTART);
+		}
+	};
+
+private:
+	// Metatable of UserData<T> generated from Method/Property/Constructor lists.
+	// Method-only classes index a plain method table, otherwise __index/__newindex
+	// dispatch through a perfect hash over the member names built at compile time
+	// and methods are served from upvalues of the __index closure.
+	template<typename T, typename TMembers, typename TConstructors>
+	class ClassBinding;
+	template<typename T, typename ... TMembers, typename ... TConstructors>
+	class ClassBinding<T, std::tuple<TMembers ...>, std::tuple<TConstructors ...>>
+	{
+		static_assert(sizeof...(TMembers) <= 255);
+		static_assert(sizeof...(TConstructors) <= 1);
+
+		typedef int(*Handler)(lua_State* lua, T* self);
+
+		template<typename>
+		struct Member;
+		template<Name NAME, auto F>
+		struct Member<Method<NAME, F>>
+		{
+			static constexpr std::string_view Key         = NAME.GetString();
+			static constexpr bool             Is_Property = false;
+
+			template<size_t I>
+			static int Index(lua_State* lua, T* self)
+			{
+				lua_pushvalue(lua, lua_upvalueindex(1 + static_cast<int>(I)));
+
+				return 1;
+			}
+
+			static int NewIndex(lua_State* lua, T* self)
+			{
+				return ReadOnlyError(lua);
+			}
+
+			static int Execute(lua_State* lua)
+			{
+				return Execute(lua, std::make_index_sequence<std::tuple_size<typename Get_MemberFunction<decltype(F)>::Args>::value> {});
+			}
+			template<size_t ... I>
+			static int Execute(lua_State* lua, std::index_sequence<I ...>)
+			{
+				auto                                           self = GetSelf(lua);
+				typename Get_MemberFunction<decltype(F)>::Args args;
+
+				((LuaCPP::Peek(lua, 2 + I, std::get<I>(args)) || PeekError(lua, 1 + I)), ...);
+
+				if constexpr (std::is_same<typename Get_MemberFunction<decltype(F)>::Return, void>::value)
+					return (self->*F)(std::move(std::get<I>(args)) ...), 0;
+				else
+					return LuaCPP::Push(lua, (self->*F)(std::move(std::get<I>(args)) ...));
+			}
+
+			static void PushUpvalue(lua_State* lua)
+			{
+				lua_pushcfunction(lua, &Execute);
+			}
+		};
+		template<Name NAME, auto GET, auto SET>
+		struct Member<Property<NAME, GET, SET>>
+		{
+			static constexpr std::string_view Key         = NAME.GetString();
+			static constexpr bool             Is_Property = true;
+
+			template<size_t I>
+			static int Index(lua_State* lua, T* self)
+			{
+				if constexpr (std::is_member_object_pointer<decltype(GET)>::value)
+					return LuaCPP::Push(lua, self->*GET);
+				else
+					return LuaCPP::Push(lua, (self->*GET)());
+			}
+
+			static int NewIndex(lua_State* lua, T* self)
+			{
+				if constexpr (std::is_member_object_pointer<decltype(GET)>::value)
+				{
+					static_assert(std::is_null_pointer<decltype(SET)>::value);
+
+					if (!LuaCPP::Peek(lua, 3, self->*GET))
+						PeekError(lua, 1);
+				}
+				else if constexpr (std::is_null_pointer<decltype(SET)>::value)
+					return ReadOnlyError(lua);
+				else
+				{
+					typename std::tuple_element<0, typename Get_MemberFunction<decltype(SET)>::Args>::type value;
+
+					if (!LuaCPP::Peek(lua, 3, value))
+						PeekError(lua, 1);
+
+					(self->*SET)(std::move(value));
+				}
+
+				return 0;
+			}
+
+			static void PushUpvalue(lua_State* lua)
+			{
+				lua_pushnil(lua);
+			}
+		};
+
+		template<typename>
+		struct Construct;
+		template<typename ... TArgs>
+		struct Construct<Constructor<TArgs ...>>
+		{
+			static int Execute(lua_State* lua)
+			{
+				return Execute(lua, std::make_index_sequence<sizeof...(TArgs)> {});
+			}
+			template<size_t ... I>
+			static int Execute(lua_State* lua, std::index_sequence<I ...>)
+			{
+				std::tuple<std::remove_cvref_t<TArgs> ...> args;
+
+				((LuaCPP::Peek(lua, 1 + I, std::get<I>(args)) || PeekError(lua, 1 + I)), ...);
+
+				UserData<T>::New(lua, std::move(std::get<I>(args)) ...);
+
+				return 1;
+			}
+		};
+
+		// FNV-1a
+		static constexpr uint32_t Hash(uint32_t seed, std::string_view value)
+		{
+			uint32_t hash = 2166136261u ^ seed;
+
+			for (auto c : value)
+			{
+				hash ^= static_cast<uint8_t>(c);
+				hash *= 16777619u;
+			}
+
+			return hash;
+		}
+
+		static constexpr size_t                                      MEMBER_COUNT   = sizeof...(TMembers);
+		static constexpr bool                                        HAS_PROPERTIES = (Member<TMembers>::Is_Property || ...);
+		static constexpr std::array<std::string_view, MEMBER_COUNT> NAMES          = { Member<TMembers>::Key ... };
+
+		static constexpr bool IsUnique()
+		{
+			for (size_t i = 0; i < MEMBER_COUNT; ++i)
+				for (size_t j = 0; j < i; ++j)
+					if (NAMES[i] == NAMES[j])
+						return false;
+
+			return true;
+		}
+
+		static constexpr size_t   TABLE_SIZE_MAX   = 0x8000;
+		static constexpr uint32_t TABLE_SEED_TRIES = 64;
+
+		// @return false if two names share a slot
+		static constexpr bool IsPerfect(size_t size, uint32_t seed)
+		{
+			std::array<uint64_t, TABLE_SIZE_MAX / 64> is_used = {};
+
+			for (auto name : NAMES)
+			{
+				auto slot = Hash(seed, name) & (size - 1);
+				auto bit  = uint64_t(1) << (slot % 64);
+
+				if (is_used[slot / 64] & bit)
+					return false;
+
+				is_used[slot / 64] |= bit;
+			}
+
+			return true;
+		}
+
+		static_assert(IsUnique(), "member names must be unique");
+
+		// starts at the next power of two with twice as many slots as members and
+		// doubles whenever a few seeds fail, large classes trade table size for a bounded search
+		static constexpr std::pair<size_t, uint32_t> TABLE_LAYOUT = []()
+		{
+			size_t size = 1;
+
+			while (size < (MEMBER_COUNT * 2))
+				size *= 2;
+
+			// reported by the assertion above, no point searching
+			if (!IsUnique())
+				return std::pair<size_t, uint32_t>(size, 0);
+
+			for (; size <= TABLE_SIZE_MAX; size *= 2)
+				for (uint32_t seed = 0; seed < TABLE_SEED_TRIES; ++seed)
+					if (IsPerfect(size, seed))
+						return std::pair<size_t, uint32_t>(size, seed);
+
+			return std::pair<size_t, uint32_t>(0, 0);
+		}();
+		static_assert(TABLE_LAYOUT.first != 0, "no collision free member table within TABLE_SIZE_MAX slots");
+
+		static constexpr size_t   TABLE_SIZE = TABLE_LAYOUT.first;
+		static constexpr uint32_t TABLE_SEED = TABLE_LAYOUT.second;
+		static constexpr std::array<int16_t, TABLE_SIZE> TABLE = []()
+		{
+			std::array<int16_t, TABLE_SIZE> table = {};
+
+			for (auto& slot : table)
+				slot = -1;
+
+			for (size_t i = 0; i < MEMBER_COUNT; ++i)
+				table[Hash(TABLE_SEED, NAMES[i]) & (TABLE_SIZE - 1)] = static_cast<int16_t>(i);
+
+			return table;
+		}();
+
+		template<size_t ... I>
+		static constexpr auto GetIndexHandlers(std::index_sequence<I ...>)
+		{
+			return std::array<Handler, MEMBER_COUNT> { &Member<TMembers>::template Index<I> ... };
+		}
+		static constexpr std::array<Handler, MEMBER_COUNT> INDEX_HANDLERS    = GetIndexHandlers(std::index_sequence_for<TMembers ...> {});
+		static constexpr std::array<Handler, MEMBER_COUNT> NEWINDEX_HANDLERS = { &Member<TMembers>::NewIndex ... };
+
+		ClassBinding() = delete;
+
+	public:
+		static void Register(lua_State* lua, std::string_view name)
+		{
+			UserData<T>::PushMetatable(lua);
+			lua_pushlstring(lua, name.data(), name.length());
+			lua_setfield(lua, -2, "__name");
+
+			if constexpr (HAS_PROPERTIES)
+			{
+				(Member<TMembers>::PushUpvalue(lua), ...);
+				lua_pushcclosure(lua, &Index, static_cast<int>(MEMBER_COUNT));
+				lua_setfield(lua, -2, "__index");
+				lua_pushcfunction(lua, &NewIndex);
+				lua_setfield(lua, -2, "__newindex");
+			}
+			else
+			{
+				lua_createtable(lua, 0, static_cast<int>(MEMBER_COUNT));
+				((Member<TMembers>::PushUpvalue(lua), lua_setfield(lua, -2, Member<TMembers>::Key.data())), ...);
+				lua_setfield(lua, -2, "__index");
+			}
+
+			lua_pop(lua, 1);
+
+			if constexpr (sizeof...(TConstructors) != 0)
+			{
+				lua_pushglobaltable(lua);
+				lua_pushlstring(lua, name.data(), name.length());
+				lua_pushcfunction(lua, &Construct<TConstructors ...>::Execute);
+				lua_settable(lua, -3);
+				lua_pop(lua, 1);
+			}
+		}
+
+	private:
+		// @return -1 if not found
+		static int  Find(lua_State* lua, int index)
+		{
+			if (lua_type(lua, index) != LUA_TSTRING)
+				return -1;
+
+			size_t length;
+			auto   string = lua_tolstring(lua, index, &length);
+			auto   key    = std::string_view(string, length);
+			auto   slot   = TABLE[Hash(TABLE_SEED, key) & (TABLE_SIZE - 1)];
+
+			return ((slot != -1) && (NAMES[slot] == key)) ? slot : -1;
+		}
+
+		static T*   GetSelf(lua_State* lua)
+		{
+			auto block = UserData<T>::ToBlock(lua, 1);
+
+			if (block == nullptr)
+			{
+				lua_pushstring(lua, "Error peeking self");
+				lua_error(lua);
+			}
+
+			return reinterpret_cast<T*>(block->value);
+		}
+
+		static int  Index(lua_State* lua)
+		{
+			auto self = GetSelf(lua);
+			auto slot = Find(lua, 2);
+
+			return (slot == -1) ? 0 : INDEX_HANDLERS[slot](lua, self);
+		}
+
+		static int  NewIndex(lua_State* lua)
+		{
+			auto self = GetSelf(lua);
+			auto slot = Find(lua, 2);
+
+			if (slot == -1)
+			{
+				lua_pushfstring(lua, "Error setting unknown member '%s'", luaL_tolstring(lua, 2, nullptr));
+				lua_error(lua);
+			}
+
+			return NEWINDEX_HANDLERS[slot](lua, self);
+		}
+
+		static bool PeekError(lua_State* lua, size_t index)
+		{
+			lua_pushfstring(lua, "Error peeking arg #%s", std::to_string(index).c_str());
+			lua_error(lua);
+
+			return false;
+		}
+
+		static int  ReadOnlyError(lua_State* lua)
+		{
+			lua_pushfstring(lua, "Error setting read-only member '%s'", lua_tostring(lua, 2));
+			lua_error(lua);
+
+			return 0;
+		}
+	};
+
+	// LRU of loaded chunks kept alive in the registry.
+	// Files are keyed by path and revalidated by write time and size,
+	// strings are keyed by their content.
+	class ChunkCache
+	{
+		struct Entry
+		{
+			std::string                     key;
+			bool                            is_file;
+			std::filesystem::file_time_type file_time;
+			uintmax_t                       file_size;
+			int                             reference;
+		};
+
+		struct Hash
+		{
+			typedef void is_transparent;
+
+			size_t operator () (std::string_view value) const
+			{
+				return std::hash<std::string_view> {}(value);
+			}
+		};
+
+		typedef std::list<Entry>                                                        EntryList;
+		typedef std::unordered_map<std::string, EntryList::iterator, Hash, std::equal_to<>> EntryMap;
+
+		size_t          capacity;
+		EntryList       entries;
+		EntryMap        files;
+		EntryMap        strings;
+		ChunkCacheStats stats = {};
+
+	public:
+		explicit ChunkCache(size_t capacity)
+			: capacity(capacity)
+		{
+		}
+
+		constexpr auto& GetStats() const
+		{
+			return stats;
+		}
+
+		// @return true if the cached function was pushed
+		bool Push(lua_State* lua, std::string_view key, bool is_file, std::filesystem::file_time_type file_time = {}, uintmax_t file_size = 0)
+		{
+			auto& map = is_file ? files : strings;
+			auto  it  = map.find(key);
+
+			if (it == map.end())
+			{
+				++stats.misses;
+
+				return false;
+			}
+
+			auto entry = it->second;
+
+			if (is_file && ((entry->file_time != file_time) || (entry->file_size != file_size)))
+			{
+				Erase(lua, entry);
+				++stats.misses;
+
+				return false;
+			}
+
+			entries.splice(entries.begin(), entries, entry);
+			lua_rawgeti(lua, LUA_REGISTRYINDEX, entry->reference);
+			++stats.hits;
+
+			return true;
+		}
+
+		// Stores the function on top of the stack, leaving it in place
+		void Insert(lua_State* lua, std::string_view key, bool is_file, std::filesystem::file_time_type file_time = {}, uintmax_t file_size = 0)
+		{
+			if (capacity == 0)
+				return;
+
+			while (entries.size() >= capacity)
+			{
+				Erase(lua, std::prev(entries.end()));
+				++stats.evictions;
+			}
+
+			lua_pushvalue(lua, -1);
+
+			entries.push_front({ std::string(key), is_file, file_time, file_size, luaL_ref(lua, LUA_REGISTRYINDEX) });
+			(is_file ? files : strings).emplace(entries.front().key, entries.begin());
+		}
+
+		void Clear(lua_State* lua)
+		{
+			while (!entries.empty())
+				Erase(lua, entries.begin());
+		}
+
+	private:
+		void Erase(lua_State* lua, EntryList::iterator entry)
+		{
+			luaL_unref(lua, LUA_REGISTRYINDEX, entry->reference);
+
+			(entry->is_file ? files : strings).erase(entry->key);
+			entries.erase(entry);
+		}
+	};
+
+	// Compact tagged binary encoding of nil, booleans, numbers, strings, tables and the trivially
+	// copyable UserData types bound with RegisterClass. Byte order and UserData layouts are native,
+	// so peers must share the architecture and build. Tables are written as their raw array part
+	// followed by the remaining pairs so reads can pre-size them, metatables are not kept and
+	// tables reachable from themselves are rejected.
+	//
+	// version:u8 value
+	// value: Nil | False | True | Integer zigzag:varint | Number f64 | String length:varint bytes
+	//        | Table array_size:varint hash_size:u32 value[array_size] (key value)[hash_size]
+	//        | UserData name_length:varint name size:varint bytes
+	class Serializer
+	{
+		enum class Tags : uint8_t
+		{
+			Nil,
+			False,
+			True,
+			Integer,
+			Number,
+			String,
+			Table,
+			UserData
+		};
+
+		static constexpr uint8_t VERSION   = 1;
+		static constexpr int     MAX_DEPTH = 200;
+
+		struct UserDataType
+		{
+			std::string      name;
+			size_t           size;
+			const uint8_t* (*get)(lua_State* lua, int index);
+			void           (*push)(lua_State* lua, const uint8_t* data);
+		};
+
+		struct Registry
+		{
+			std::mutex                                              mutex;
+			std::unordered_map<const void*, UserDataType>           types;
+			std::map<std::string, const UserDataType*, std::less<>> names;
+		};
+
+		class Writer
+		{
+			lua_State*               lua;
+			std::vector<uint8_t>*    vector;
+			uint8_t*                 data;
+			size_t                   capacity;
+			size_t                   size;
+			std::vector<const void*> path;
+
+		public:
+			Writer(lua_State* lua, std::vector<uint8_t>& buffer)
+				: lua(lua),
+				vector(&buffer),
+				size(0)
+			{
+				buffer.resize((std::max)(buffer.capacity(), size_t(256)));
+
+				data     = buffer.data();
+				capacity = buffer.size();
+			}
+			Writer(lua_State* lua, std::span<uint8_t> buffer)
+				: lua(lua),
+				vector(nullptr),
+				data(buffer.data()),
+				capacity(buffer.size()),
+				size(0)
+			{
+			}
+
+			constexpr size_t GetSize() const
+			{
+				return size;
+			}
+
+			// @throw std::exception
+			void WriteHeader()
+			{
+				Append(&VERSION, sizeof(VERSION));
+			}
+
+			// @throw std::exception
+			void WriteValue(int index)
+			{
+				switch (int type = lua_type(lua, index))
+				{
+					case LUA_TNIL:
+						WriteTag(Tags::Nil);
+						break;
+
+					case LUA_TBOOLEAN:
+						WriteTag(lua_toboolean(lua, index) ? Tags::True : Tags::False);
+						break;
+
+					case LUA_TNUMBER:
+						if (lua_isinteger(lua, index))
+						{
+							auto value = lua_tointeger(lua, index);
+
+							WriteTag(Tags::Integer);
+							WriteVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+						}
+						else
+						{
+							auto value = lua_tonumber(lua, index);
+
+							WriteTag(Tags::Number);
+							Append(&value, sizeof(value));
+						}
+						break;
+
+					case LUA_TSTRING:
+					{
+						size_t length;
+						auto   string = lua_tolstring(lua, index, &length);
+
+						WriteTag(Tags::String);
+						WriteVarint(length);
+						Append(string, length);
+						break;
+					}
+
+					case LUA_TTABLE:
+						WriteTable(lua_absindex(lua, index));
+						break;
+
+					case LUA_TUSERDATA:
+						WriteUserData(index);
+						break;
+
+					default:
+						throw Exception("LuaCPP::Serialize", std::string("unsupported type ").append(lua_typename(lua, type)));
+				}
+			}
+
+		private:
+			void WriteTable(int index)
+			{
+				auto table = lua_topointer(lua, index);
+
+				if (std::find(path.begin(), path.end(), table) != path.end())
+					throw Exception("LuaCPP::Serialize", "table contains itself");
+
+				if ((path.size() >= MAX_DEPTH) || !lua_checkstack(lua, 3))
+					throw Exception("LuaCPP::Serialize", "tables nested too deep");
+
+				path.push_back(table);
+
+				auto array_size = static_cast<lua_Integer>(lua_rawlen(lua, index));
+
+				WriteTag(Tags::Table);
+				WriteVarint(static_cast<uint64_t>(array_size));
+
+				uint32_t hash_size   = 0;
+				size_t   hash_offset = size;
+
+				Append(&hash_size, sizeof(hash_size));
+
+				for (lua_Integer i = 1; i <= array_size; ++i)
+				{
+					lua_rawgeti(lua, index, i);
+					WriteValue(-1);
+					lua_pop(lua, 1);
+				}
+
+				for (lua_pushnil(lua); lua_next(lua, index); lua_pop(lua, 1))
+				{
+					if (lua_isinteger(lua, -2))
+						if (auto key = lua_tointeger(lua, -2); (key >= 1) && (key <= array_size))
+							continue;
+
+					WriteValue(-2);
+					WriteValue(-1);
+					++hash_size;
+				}
+
+				std::memcpy(data + hash_offset, &hash_size, sizeof(hash_size));
+
+				path.pop_back();
+			}
+
+			void WriteUserData(int index)
+			{
+				const UserDataType* type  = nullptr;
+				const uint8_t*      value = nullptr;
+
+				// LuaCPP userdata start with their type id
+				if (lua_rawlen(lua, index) >= sizeof(const void*))
+					if ((type = Find(*static_cast<const void* const*>(lua_touserdata(lua, index)))))
+						value = type->get(lua, index);
+
+				if (value == nullptr)
+					throw Exception("LuaCPP::Serialize", "userdata type not registered with RegisterClass or not trivially copyable");
+
+				WriteTag(Tags::UserData);
+				WriteVarint(type->name.length());
+				Append(type->name.data(), type->name.length());
+				WriteVarint(type->size);
+				Append(value, type->size);
+			}
+
+			void WriteTag(Tags tag)
+			{
+				Append(&tag, sizeof(tag));
+			}
+
+			void WriteVarint(uint64_t value)
+			{
+				uint8_t buffer[10];
+				size_t  length = 0;
+
+				for (; value >= 0x80; value >>= 7)
+					buffer[length++] = static_cast<uint8_t>(value | 0x80);
+
+				buffer[length++] = static_cast<uint8_t>(value);
+
+				Append(buffer, length);
+			}
+
+			void Append(const void* source, size_t source_size)
+			{
+				if (source_size > (capacity - size))
+				{
+					if (vector == nullptr)
+						throw Exception("LuaCPP::Serialize", "buffer too small");
+
+					vector->resize((std::max)(size + source_size, capacity * 2));
+
+					data     = vector->data();
+					capacity = vector->size();
+				}
+
+				if (source_size != 0)
+					std::memcpy(data + size, source, source_size);
+
+				size += source_size;
+			}
+		};
+
+		class Reader
+		{
+			lua_State*     lua;
+			const uint8_t* data;
+			size_t         size;
+			size_t         offset;
+
+		public:
+			Reader(lua_State* lua, std::span<const uint8_t> buffer)
+				: lua(lua),
+				data(buffer.data()),
+				size(buffer.size()),
+				offset(0)
+			{
+			}
+
+			// @throw std::exception
+			void ReadHeader()
+			{
+				if (uint8_t version; Read(&version, sizeof(version)), version != VERSION)
+					throw Exception("LuaCPP::Deserialize", std::string("unsupported version ").append(std::to_string(version)));
+			}
+
+			// Pushes the value
+			// @throw std::exception
+			void ReadValue(int depth)
+			{
+				if ((depth > MAX_DEPTH) || !lua_checkstack(lua, 3))
+					throw Exception("LuaCPP::Deserialize", "tables nested too deep");
+
+				Tags tag;
+				Read(&tag, sizeof(tag));
+
+				switch (tag)
+				{
+					case Tags::Nil:
+						lua_pushnil(lua);
+						break;
+
+					case Tags::False:
+					case Tags::True:
+						lua_pushboolean(lua, (tag == Tags::True) ? 1 : 0);
+						break;
+
+					case Tags::Integer:
+					{
+						auto value = ReadVarint();
+
+						lua_pushinteger(lua, static_cast<lua_Integer>((value >> 1) ^ (0 - (value & 1))));
+						break;
+					}
+
+					case Tags::Number:
+					{
+						lua_Number value;
+						Read(&value, sizeof(value));
+
+						lua_pushnumber(lua, value);
+						break;
+					}
+
+					case Tags::String:
+					{
+						auto length = ReadVarint();
+
+						lua_pushlstring(lua, reinterpret_cast<const char*>(Skip(length)), static_cast<size_t>(length));
+						break;
+					}
+
+					case Tags::Table:
+						ReadTable(depth);
+						break;
+
+					case Tags::UserData:
+						ReadUserData();
+						break;
+
+					default:
+						throw Exception("LuaCPP::Deserialize", std::string("invalid tag ").append(std::to_string(static_cast<int>(tag))));
+				}
+			}
+
+		private:
+			void ReadTable(int depth)
+			{
+				auto     array_size = ReadVarint();
+				uint32_t hash_size;
+				Read(&hash_size, sizeof(hash_size));
+
+				// every value takes at least a byte, which bounds what a corrupt size can make us allocate
+				if ((array_size > (size - offset)) || (hash_size > ((size - offset) / 2)) || (array_size > INT_MAX))
+					throw Exception("LuaCPP::Deserialize", "table size exceeds buffer");
+
+				lua_createtable(lua, static_cast<int>(array_size), static_cast<int>(hash_size));
+
+				for (lua_Integer i = 1; i <= static_cast<lua_Integer>(array_size); ++i)
+				{
+					ReadValue(depth + 1);
+
+					if (lua_isnil(lua, -1))
+						lua_pop(lua, 1);
+					else
+						lua_rawseti(lua, -2, i);
+				}
+
+				for (uint32_t i = 0; i < hash_size; ++i)
+				{
+					ReadValue(depth + 1);
+
+					if (lua_isnil(lua, -1) || ((lua_type(lua, -1) == LUA_TNUMBER) && (lua_tonumber(lua, -1) != lua_tonumber(lua, -1))))
+						throw Exception("LuaCPP::Deserialize", "invalid table key");
+
+					ReadValue(depth + 1);
+					lua_rawset(lua, -3);
+				}
+			}
+
+			void ReadUserData()
+			{
+				auto length = ReadVarint();
+				auto name   = std::string_view(reinterpret_cast<const char*>(Skip(length)), static_cast<size_t>(length));
+				auto type   = Find(name);
+
+				if (type == nullptr)
+					throw Exception("LuaCPP::Deserialize", std::string("userdata type ").append(name).append(" not registered"));
+
+				if (ReadVarint() != type->size)
+					throw Exception("LuaCPP::Deserialize", std::string("userdata type ").append(name).append(" changed size"));
+
+				type->push(lua, Skip(type->size));
+			}
+
+			uint64_t ReadVarint()
+			{
+				uint64_t value = 0;
+
+				for (int shift = 0; shift < 64; shift += 7)
+				{
+					uint8_t byte;
+					Read(&byte, sizeof(byte));
+
+					value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+					if ((byte & 0x80) == 0)
+						return value;
+				}
+
+				throw Exception("LuaCPP::Deserialize", "invalid varint");
+			}
+
+			void Read(void* destination, size_t destination_size)
+			{
+				std::memcpy(destination, Skip(destination_size), destination_size);
+			}
+
+			// @return pointer to the next length bytes
+			const uint8_t* Skip(uint64_t length)
+			{
+				if (length > (size - offset))
+					throw Exception("LuaCPP::Deserialize", "unexpected end of buffer");
+
+				auto pointer = data + offset;
+				offset += static_cast<size_t>(length);
+
+				return pointer;
+			}
+		};
+
+		Serializer() = delete;
+
+	public:
+		// Lets UserData<T> be serialized as its bytes under name, the first name registered for T wins
+		template<typename T>
+		static void Register(std::string_view name)
+		{
+			static_assert(std::is_trivially_copyable<T>::value);
+
+			auto&                       registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			auto [it, inserted] = registry.types.try_emplace(&UserData<T>::TYPE_ID, UserDataType { std::string(name), sizeof(T), &GetUserData<T>, &PushUserData<T> });
+
+			if (inserted)
+				registry.names.try_emplace(it->second.name, &it->second);
+		}
+
+		// @throw std::exception
+		static void   Serialize(lua_State* lua, int index, std::vector<uint8_t>& buffer)
+		{
+			auto   top = lua_gettop(lua);
+			Writer writer(lua, buffer);
+
+			try
+			{
+				writer.WriteHeader();
+				writer.WriteValue(lua_absindex(lua, index));
+			}
+			catch (...)
+			{
+				lua_settop(lua, top);
+				buffer.clear();
+
+				throw;
+			}
+
+			buffer.resize(writer.GetSize());
+		}
+		// @throw std::exception
+		// @return number of bytes written
+		static size_t Serialize(lua_State* lua, int index, std::span<uint8_t> buffer)
+		{
+			auto   top = lua_gettop(lua);
+			Writer writer(lua, buffer);
+
+			try
+			{
+				writer.WriteHeader();
+				writer.WriteValue(lua_absindex(lua, index));
+			}
+			catch (...)
+			{
+				lua_settop(lua, top);
+
+				throw;
+			}
+
+			return writer.GetSize();
+		}
+
+		// Pushes the value
+		// @throw std::exception
+		static void   Deserialize(lua_State* lua, std::span<const uint8_t> buffer)
+		{
+			auto   top = lua_gettop(lua);
+			Reader reader(lua, buffer);
+
+			try
+			{
+				reader.ReadHeader();
+				reader.ReadValue(0);
+			}
+			catch (...)
+			{
+				lua_settop(lua, top);
+
+				throw;
+			}
+		}
+
+	private:
+		static Registry& GetRegistry()
+		{
+			static Registry registry;
+
+			return registry;
+		}
+
+		static const UserDataType* Find(const void* type_id)
+		{
+			auto&                       registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			auto it = registry.types.find(type_id);
+
+			return (it != registry.types.end()) ? &it->second : nullptr;
+		}
+		static const UserDataType* Find(std::string_view name)
+		{
+			auto&                       registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			auto it = registry.names.find(name);
+
+			return (it != registry.names.end()) ? it->second : nullptr;
+		}
+
+		template<typename T>
+		static const uint8_t* GetUserData(lua_State* lua, int index)
+		{
+			auto block = UserData<T>::ToBlock(lua, index);
+
+			return block ? block->value : nullptr;
+		}
+
+		template<typename T>
+		static void           PushUserData(lua_State* lua, const uint8_t* data)
+		{
+			std::array<uint8_t, sizeof(T)> bytes;
+			std::memcpy(bytes.data(), data, sizeof(T));
+
+			UserData<T>::New(lua, std::bit_cast<T>(bytes));
+		}
+	};
+
+	// Count hook state shared by every coroutine of a state, found through the registry
+	// since coroutines inherit the hook but not the LuaCPP owning it.
+	// Serves both the budgets and the sampling profiler.
+	struct Hooks
+	{
+		static_assert(std::atomic<bool>::is_always_lock_free);
+
+		// address is the registry key
+		static constexpr char KEY       = 0;
+		// address is the registry key of the last budget error raised
+		static constexpr char ERROR_KEY = 0;
+		// profilers running at once
+		static constexpr size_t SAMPLE_FLAG_COUNT = 64;
+
+		uint64_t                                instructions;
+		std::chrono::nanoseconds                time;
+		int                                     budget_interval;
+		size_t                                  depth;
+		uint64_t                                instructions_left;
+		std::chrono::steady_clock::time_point   deadline;
+		Budgets                                 exceeded;
+		// 0 when not profiling
+		int                                     profile_interval;
+		// set from the timer signal, picked up by the next hook or binding call
+		std::atomic<bool>*                      sample;
+		std::unordered_map<std::string, size_t> samples;
+#if defined(__linux__)
+		timer_t                                 timer;
+#endif
+		// instructions between two hook calls
+		int                                     interval;
+
+		Hooks()
+			: instructions(0),
+			time(0),
+			budget_interval(0),
+			depth(0),
+			instructions_left(0),
+			exceeded(Budgets::None),
+			profile_interval(0),
+			sample(&GetSampleFlags()[SAMPLE_FLAG_COUNT]),
+			interval(0)
+		{
+		}
+
+		static Hooks* Get(lua_State* lua)
+		{
+			lua_rawgetp(lua, LUA_REGISTRYINDEX, &KEY);
+			auto hooks = static_cast<Hooks*>(lua_touserdata(lua, -1));
+			lua_pop(lua, 1);
+
+			return hooks;
+		}
+
+		constexpr bool IsBudgeted() const
+		{
+			return (instructions != 0) || (time.count() != 0);
+		}
+
+		void Begin()
+		{
+			instructions_left = instructions;
+			deadline          = (time.count() != 0) ? (std::chrono::steady_clock::now() + time) : std::chrono::steady_clock::time_point::max();
+			exceeded          = Budgets::None;
+		}
+
+		// Adds the current stack of lua, outermost frame first, to the folded samples
+		void Sample(lua_State* lua)
+		{
+			sample->store(false, std::memory_order_relaxed);
+
+			std::string stack;
+			lua_Debug   debug;
+			int         depth = 0;
+
+			while (lua_getstack(lua, depth, &debug))
+				++depth;
+
+			for (int level = depth - 1; level >= 0; --level)
+			{
+				if (!lua_getstack(lua, level, &debug) || !lua_getinfo(lua, "Sn", &debug))
+					continue;
+
+				if (!stack.empty())
+					stack.push_back(';');
+
+				stack.append(debug.name ? debug.name : (strcmp(debug.what, "main") == 0) ? "main" : "?");
+
+				if (strcmp(debug.what, "C") == 0)
+					stack.append(" [C]");
+				else
+					stack.append(" (").append(debug.short_src).append(":").append(std::to_string(debug.linedefined)).append(")");
+			}
+
+			++samples[stack];
+		}
+
+		// Lets C++ bindings show up in samples taken while they run, count hooks only see Lua code
+		static void SampleBinding(lua_State* lua)
+		{
+			if (lua_gethook(lua) == &Hooks::Execute)
+				if (auto hooks = Get(lua); (hooks != nullptr) && hooks->sample->load(std::memory_order_relaxed))
+					hooks->Sample(lua);
+		}
+
+		// Runs every interval instructions, budgets are only checked inside a budgeted call
+		static void Execute(lua_State* lua, lua_Debug* debug)
+		{
+			auto hooks = Get(lua);
+
+			if (hooks == nullptr)
+				return;
+
+			if (hooks->sample->load(std::memory_order_relaxed))
+				hooks->Sample(lua);
+
+			if ((hooks->depth == 0) || !hooks->IsBudgeted())
+			{
+				// still firing on every instruction after an exceeded budget
+				if (lua_gethookcount(lua) != hooks->interval)
+					lua_sethook(lua, &Hooks::Execute, LUA_MASKCOUNT, hooks->interval);
+
+				return;
+			}
+
+			if (hooks->instructions != 0)
+			{
+				if (hooks->instructions_left <= static_cast<uint64_t>(hooks->interval))
+					hooks->exceeded = Budgets::Instructions;
+				else
+					hooks->instructions_left -= hooks->interval;
+			}
+
+			if ((hooks->exceeded == Budgets::None) && (std::chrono::steady_clock::now() >= hooks->deadline))
+				hooks->exceeded = Budgets::Time;
+
+			if (hooks->exceeded == Budgets::None)
+				return;
+
+			// a coroutine gives way instead, its next resume starts a new budget
+			if (lua_isyieldable(lua))
+			{
+				if (lua_gethookcount(lua) != hooks->interval)
+					lua_sethook(lua, &Hooks::Execute, LUA_MASKCOUNT, hooks->interval);
+
+				lua_yield(lua, 0);
+			}
+			else
+			{
+				luaL_where(lua, 1);
+				lua_pushstring(lua, (hooks->exceeded == Budgets::Instructions) ? "instruction budget exceeded" : "time budget exceeded");
+				lua_concat(lua, 2);
+				lua_pushvalue(lua, -1);
+				lua_rawsetp(lua, LUA_REGISTRYINDEX, &ERROR_KEY);
+
+				// a pcall in the script would swallow the error, raise it again on the next
+				// instruction until it reaches the outermost call
+				lua_sethook(lua, &Hooks::Execute, LUA_MASKCOUNT, 1);
+				lua_error(lua);
+			}
+		}
+
+		// @return true if the value at index is the last budget error raised
+		static bool IsError(lua_State* lua, int index)
+		{
+			index = lua_absindex(lua, index);
+
+			lua_rawgetp(lua, LUA_REGISTRYINDEX, &ERROR_KEY);
+			bool is_error = lua_rawequal(lua, index, -1);
+			lua_pop(lua, 1);
+
+			return is_error;
+		}
+
+#if defined(__linux__)
+		// Shared by every profiling state, the timer passes the index of the flag to set along
+		static void OnSignal(int, siginfo_t* info, void*)
+		{
+			if ((info->si_code == SI_TIMER) && (static_cast<size_t>(info->si_value.sival_int) < SAMPLE_FLAG_COUNT))
+				GetSampleFlags()[info->si_value.sival_int].store(true, std::memory_order_relaxed);
+		}
+
+		// Installs OnSignal for SIGPROF on first use and keeps it for the lifetime of the process,
+		// restoring the default disposition would let a signal still queued end the process
+		// @return false if sigaction failed
+		static bool UseSignal()
+		{
+			static std::mutex mutex;
+			static bool       is_installed = false;
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!is_installed)
+			{
+				struct sigaction action = {};
+				action.sa_sigaction     = &Hooks::OnSignal;
+				action.sa_flags         = SA_SIGINFO | SA_RESTART;
+				sigemptyset(&action.sa_mask);
+
+				if (sigaction(SIGPROF, &action, nullptr) == -1)
+					return false;
+
+				is_installed = true;
+			}
+
+			return true;
+		}
+
+		// @return -1 if every flag is taken
+		static int  AcquireSampleFlag()
+		{
+			auto&                       owners = GetSampleFlagOwners();
+			std::lock_guard<std::mutex> lock(owners.mutex);
+
+			for (size_t i = 0; i < SAMPLE_FLAG_COUNT; ++i)
+			{
+				if (!owners.is_used[i])
+				{
+					owners.is_used[i] = true;
+					GetSampleFlags()[i].store(false, std::memory_order_relaxed);
+
+					return static_cast<int>(i);
+				}
+			}
+
+			return -1;
+		}
+
+		// A signal of the previous owner may still set the flag, costing the next owner a stray sample
+		static void ReleaseSampleFlag(std::atomic<bool>* flag)
+		{
+			auto&                       owners = GetSampleFlagOwners();
+			std::lock_guard<std::mutex> lock(owners.mutex);
+
+			owners.is_used[flag - GetSampleFlags()] = false;
+		}
+
+		struct SampleFlagOwners
+		{
+			std::mutex                          mutex;
+			std::array<bool, SAMPLE_FLAG_COUNT> is_used;
+		};
+
+		static SampleFlagOwners& GetSampleFlagOwners()
+		{
+			static SampleFlagOwners owners = {};
+
+			return owners;
+		}
+#endif
+
+		// Flags the timer signal sets by index. They outlive every Hooks so a signal still queued after
+		// StopProfiler never writes into freed memory. The last one is never set and stands in while not profiling.
+		static std::atomic<bool>* GetSampleFlags()
+		{
+			// constant initialized, the signal handler never runs into a guard
+			static std::atomic<bool> flags[SAMPLE_FLAG_COUNT + 1];
+
+			return flags;
+		}
+	};
+
+	// Starts a fresh budget for the outermost call on a state, costs a lua_gethook without one
+	class BudgetScope
+	{
+		Hooks* hooks;
+
+	public:
+		explicit BudgetScope(lua_State* lua)
+			: hooks((lua_gethook(lua) == &Hooks::Execute) ? Hooks::Get(lua) : nullptr)
+		{
+			if ((hooks != nullptr) && (hooks->depth++ == 0))
+				hooks->Begin();
+		}
+
+		BudgetScope(const BudgetScope&) = delete;
+
+		~BudgetScope()
+		{
+			if (hooks != nullptr)
+				--hooks->depth;
+		}
+	};
+
+	lua_State*                  lua;
+	bool                        lua_is_owned;
+	std::unique_ptr<ChunkCache> chunk_cache;
+	std::unique_ptr<Hooks>      hooks;
+	std::unique_ptr<GCStats>    gc_stats;
+
+	LuaCPP(const LuaCPP&) = delete;
+
+public:
+	LuaCPP()
+		: lua(luaL_newstate()),
+		lua_is_owned(true)
+	{
+	}
+	LuaCPP(LuaCPP&& state)
+		: lua(state.lua),
+		lua_is_owned(state.lua_is_owned),
+		chunk_cache(std::move(state.chunk_cache)),
+		hooks(std::move(state.hooks)),
+		gc_stats(std::move(state.gc_stats))
+	{
+		state.lua          = nullptr;
+		state.lua_is_owned = false;
+	}
+
+	LuaCPP(lua_Alloc alloc, void* param)
+#if defined(LUACPP_IS_LUA54)
+		: lua(lua_newstate(alloc, param)),
+#elif defined(LUACPP_IS_LUA55)
+		: lua(lua_newstate(alloc, param, luaL_makeseed(nullptr))),
+#endif
+		lua_is_owned(true)
+	{
+	}
+	LuaCPP(SlabAllocator& allocator)
+		: LuaCPP(&SlabAllocator::Alloc, &allocator)
+	{
+	}
+	LuaCPP(AccountingAllocator& allocator)
+		: LuaCPP(&AccountingAllocator::Alloc, &allocator)
+	{
+	}
+
+	LuaCPP(lua_State* state, bool take_ownership)
+		: lua(state),
+		lua_is_owned(take_ownership)
+	{
+	}
+
+	virtual ~LuaCPP()
+	{
+		Release();
+	}
+
+	// @throw std::exception
+	void Run(std::string_view lua)
+	{
+		assert(this->lua != nullptr);
+
+		BudgetScope budget(this->lua);
+
+		if (chunk_cache)
+		{
+			if (!chunk_cache->Push(this->lua, lua, false))
+			{
+				if (luaL_loadstring(this->lua, lua.data()) != LUA_OK)
+					throw Exception("luaL_loadstring", this->lua);
+
+				chunk_cache->Insert(this->lua, lua, false);
+			}
+
+			if (lua_pcall(this->lua, 0, LUA_MULTRET, 0) != LUA_OK)
+				ThrowError("lua_pcall", this->lua);
+		}
+		else if (luaL_dostring(this->lua, lua.data()))
+			ThrowError("luaL_dostring", this->lua);
+	}
+	// @throw std::exception
+	void Run(const void* buffer, size_t size, std::string_view name)
+	{
+		assert(lua != nullptr);
+
+		if (luaL_loadbuffer(lua, (const char*)buffer, size, name.data()) != LUA_OK)
+			throw Exception("luaL_loadbuffer", lua);
+
+		BudgetScope budget(lua);
+
+		if (lua_pcall(lua, 0, 0, 0) != LUA_OK)
+		{
+			lua_remove(lua, -2);
+
+			ThrowError("lua_pcall", lua);
+		}
+	}
+	// @throw std::exception
+	// @return false if not found
+	bool RunFile(std::string_view path)
+	{
+		assert(lua != nullptr);
+
+		if (!FileExists(path))
+			return false;
+
+		if (chunk_cache)
+		{
+			std::error_code time_error;
+			std::error_code size_error;
+
+			auto file_time = std::filesystem::last_write_time(path, time_error);
+			auto file_size = std::filesystem::file_size(path, size_error);
+			// entries are validated against both, bypass the cache if either is unknown
+			auto cacheable = !time_error && !size_error;
+
+			if (!cacheable || !chunk_cache->Push(lua, path, true, file_time, file_size))
+			{
+				if (luaL_loadfile(lua, path.data()) != LUA_OK)
+					throw Exception("luaL_loadfile", lua);
+
+				if (cacheable)
+					chunk_cache->Insert(lua, path, true, file_time, file_size);
+			}
+
+			BudgetScope budget(lua);
+
+			if (lua_pcall(lua, 0, LUA_MULTRET, 0) != LUA_OK)
+				ThrowError("lua_pcall", lua);
+		}
+		else
+		{
+			BudgetScope budget(lua);
+
+			if (luaL_dofile(lua, path.data()))
+				ThrowError("luaL_dofile", lua);
+		}
+
+		return true;
+	}
+
+	// @throw std::exception
+	// @return false if not found
+	bool RunMapped(std::string_view path)
+	{
+		assert(lua != nullptr);
+
+		if (!LoadMapped(path))
+			return false;
+
+		BudgetScope budget(lua);
+
+		if (lua_pcall(lua, 0, LUA_MULTRET, 0) != LUA_OK)
+			ThrowError("lua_pcall", lua);
+
+		return true;
+	}
+
+	// Loads a source or bytecode file through a read-only memory mapping and
+	// pushes the resulting function, falls back to luaL_loadfile where mmap is unavailable
+	// @throw std::exception
+	// @return false if not found or not a regular file
+	bool LoadMapped(std::string_view path)
+	{
+		assert(lua != nullptr);
+
+#if defined(__unix__) || defined(__APPLE__)
+		int file = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+
+		if (file == -1)
+		{
+			if ((errno == ENOENT) || (errno == ENOTDIR))
+				return false;
+
+			throw Exception("open", errno);
+		}
+
+		struct stat file_stat;
+
+		if (::fstat(file, &file_stat) == -1)
+		{
+			auto error = errno;
+
+			::close(file);
+
+			throw Exception("fstat", error);
+		}
+
+		if (!S_ISREG(file_stat.st_mode))
+		{
+			::close(file);
+
+			return false;
+		}
+
+		auto size = static_cast<size_t>(file_stat.st_size);
+		auto data = (size == 0) ? nullptr : ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+		::close(file);
+
+		if (data == MAP_FAILED)
+			throw Exception("mmap", std::strerror(errno));
+
+		// advice values are not flags, each needs its own call
+		if (data != nullptr)
+		{
+			::madvise(data, size, MADV_SEQUENTIAL);
+			::madvise(data, size, MADV_WILLNEED);
+		}
+
+		struct Reader
+		{
+			const char* data;
+			size_t      size;
+
+			static const char* Read(lua_State* lua, void* param, size_t* size)
+			{
+				auto reader = (Reader*)param;
+
+				*size        = reader->size;
+				reader->size = 0;
+
+				return (*size != 0) ? reader->data : nullptr;
+			}
+		};
+
+		Reader reader = { (const char*)data, size };
+
+		// skip a utf-8 bom and a leading # line like luaL_loadfile
+		if ((reader.size >= 3) && (std::memcmp(reader.data, "\xEF\xBB\xBF", 3) == 0))
+		{
+			reader.data += 3;
+			reader.size -= 3;
+		}
+
+		if ((reader.size != 0) && (reader.data[0] == '#'))
+			while ((reader.size != 0) && (reader.data[0] != '\n'))
+			{
+				++reader.data;
+				--reader.size;
+			}
+
+		int result = lua_load(lua, &Reader::Read, &reader, std::string("@").append(path).c_str(), nullptr);
+
+		if (data != nullptr)
+			::munmap(data, size);
+
+		if (result != LUA_OK)
+			throw Exception("lua_load", lua);
+#else
+		if (!FileExists(path))
+			return false;
+
+		if (luaL_loadfile(lua, path.data()) != LUA_OK)
+			throw Exception("luaL_loadfile", lua);
+#endif
+
+		return true;
+	}
+
+	// Keeps up to capacity loaded chunks so repeated Run/RunFile calls skip the parser
+	// @param capacity 0 to disable
+	void EnableChunkCache(size_t capacity)
+	{
+		assert(lua != nullptr);
+
+		if (chunk_cache)
+		{
+			chunk_cache->Clear(lua);
+			chunk_cache.reset();
+		}
+
+		if (capacity != 0)
+			chunk_cache = std::make_unique<ChunkCache>(capacity);
+	}
+
+	// @return nullptr if the chunk cache is disabled
+	const ChunkCacheStats* GetChunkCacheStats() const
+	{
+		return chunk_cache ? &chunk_cache->GetStats() : nullptr;
+	}
+
+	// Parameters are passed through in the units of the Lua version in use, 0 keeps the current value
+	// @param pause LUA_GCPPAUSE on 5.5
+	// @param step_multiplier LUA_GCPSTEPMUL on 5.5
+	// @param step_size log2 of bytes on 5.4, LUA_GCPSTEPSIZE on 5.5
+	// @return previous mode
+	GCModes SetGCIncremental(int pause = 0, int step_multiplier = 0, int step_size = 0)
+	{
+		assert(lua != nullptr);
+
+#if defined(LUACPP_IS_LUA54)
+		int mode = lua_gc(lua, LUA_GCINC, pause, step_multiplier, step_size);
+#elif defined(LUACPP_IS_LUA55)
+		int mode = lua_gc(lua, LUA_GCINC);
+
+		SetGCParameter(LUA_GCPPAUSE, pause);
+		SetGCParameter(LUA_GCPSTEPMUL, step_multiplier);
+		SetGCParameter(LUA_GCPSTEPSIZE, step_size);
+#endif
+
+		return (mode == LUA_GCGEN) ? GCModes::Generational : GCModes::Incremental;
+	}
+	// Parameters are passed through in the units of the Lua version in use, 0 keeps the current value
+	// @param minor_multiplier LUA_GCPMINORMUL on 5.5
+	// @param major_multiplier LUA_GCPMAJORMINOR on 5.5
+	// @return previous mode
+	GCModes SetGCGenerational(int minor_multiplier = 0, int major_multiplier = 0)
+	{
+		assert(lua != nullptr);
+
+#if defined(LUACPP_IS_LUA54)
+		int mode = lua_gc(lua, LUA_GCGEN, minor_multiplier, major_multiplier);
+#elif defined(LUACPP_IS_LUA55)
+		int mode = lua_gc(lua, LUA_GCGEN);
+
+		SetGCParameter(LUA_GCPMINORMUL, minor_multiplier);
+		SetGCParameter(LUA_GCPMAJORMINOR, major_multiplier);
+#endif
+
+		return (mode == LUA_GCGEN) ? GCModes::Generational : GCModes::Incremental;
+	}
+
+	void StopGC()
+	{
+		assert(lua != nullptr);
+
+		lua_gc(lua, LUA_GCSTOP);
+	}
+
+	void RestartGC()
+	{
+		assert(lua != nullptr);
+
+		lua_gc(lua, LUA_GCRESTART);
+	}
+
+	bool IsGCRunning() const
+	{
+		assert(lua != nullptr);
+
+		return lua_gc(lua, LUA_GCISRUNNING) != 0;
+	}
+
+	// Runs a full cycle, the pause it causes is what StepGC is for
+	void CollectGC()
+	{
+		assert(lua != nullptr);
+
+		lua_gc(lua, LUA_GCCOLLECT);
+	}
+
+	// @return bytes in use by the state
+	size_t GetGCMemory() const
+	{
+		assert(lua != nullptr);
+
+		return (static_cast<size_t>(lua_gc(lua, LUA_GCCOUNT)) * 1024) + static_cast<size_t>(lua_gc(lua, LUA_GCCOUNTB));
+	}
+
+	// Performs the collection work allocating kilobytes would have triggered, also while stopped
+	// @param kilobytes 0 for a single basic step
+	// @return true if the step finished a cycle
+	bool StepGC(size_t kilobytes = 0)
+	{
+		assert(lua != nullptr);
+
+		if (!gc_stats)
+			gc_stats = std::make_unique<GCStats>();
+
+		auto bytes = GetGCMemory();
+		auto start = std::chrono::steady_clock::now();
+
+#if defined(LUACPP_IS_LUA54)
+		bool is_cycle_finished = lua_gc(lua, LUA_GCSTEP, static_cast<int>(kilobytes)) != 0;
+#elif defined(LUACPP_IS_LUA55)
+		bool is_cycle_finished = lua_gc(lua, LUA_GCSTEP, kilobytes * 1024) != 0;
+#endif
+
+		auto elapsed   = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		auto reclaimed = bytes - (std::min)(bytes, GetGCMemory());
+
+		gc_stats->steps++;
+		gc_stats->cycles               += is_cycle_finished ? 1 : 0;
+		gc_stats->bytes_reclaimed      += reclaimed;
+		gc_stats->last_bytes_reclaimed  = reclaimed;
+		gc_stats->step_time            += elapsed;
+		gc_stats->step_time_max         = (std::max)(gc_stats->step_time_max, elapsed);
+		gc_stats->last_step_time        = elapsed;
+
+		return is_cycle_finished;
+	}
+
+	// Steps until a cycle finishes or time runs out, meant for idle callbacks and the gaps between requests.
+	// A step is never interrupted, so the last one may overrun time by up to one step.
+	// @param kilobytes work per step, 0 for basic steps
+	// @return true if a cycle finished
+	bool StepGCFor(std::chrono::nanoseconds time, size_t kilobytes = 0)
+	{
+		auto deadline = std::chrono::steady_clock::now() + time;
+
+		do
+		{
+			if (StepGC(kilobytes))
+				return true;
+		} while (std::chrono::steady_clock::now() < deadline);
+
+		return false;
+	}
+
+	// @return nullptr until the first StepGC
+	const GCStats* GetGCStats() const
+	{
+		return gc_stats.get();
+	}
+
+	void ResetGCStats()
+	{
+		gc_stats.reset();
+	}
+
+	// Limits every Run, RunFile, ExecuteProtected and Thread::Resume call, nested calls share the
+	// budget of the outermost one. Running out raises BudgetException, or yields inside a coroutine.
+	// Coroutines created before the budget was set are not limited. Called from a binding
+	// while a limited call runs, the new budget applies to the rest of that call from now on.
+	// @param instructions 0 for no limit
+	// @param time 0 for no limit
+	// @param interval instructions between checks, both limits are only as precise as this
+	void SetBudget(uint64_t instructions, std::chrono::nanoseconds time = std::chrono::nanoseconds(0), int interval = 1000)
+	{
+		assert(lua != nullptr);
+
+		if (!hooks)
+			hooks = std::make_unique<Hooks>();
+
+		hooks->instructions    = instructions;
+		hooks->time            = time;
+		hooks->budget_interval = (interval > 0) ? interval : 1;
+
+		// the depth belongs to the BudgetScopes still on the stack
+		if (hooks->depth != 0)
+			hooks->Begin();
+		else
+			hooks->exceeded = Budgets::None;
+
+		UpdateHooks();
+	}
+
+#if defined(__linux__)
+	// Samples the Lua stack frequency times per second of CPU time of the calling thread,
+	// which has to be the one running the state. The timer signal only raises a flag,
+	// the stack is captured by the next hook call or C++ binding returning.
+	// CPU-time timers fire at most at the kernel tick rate (CONFIG_HZ).
+	// @param interval instructions between checks for a pending sample
+	// @throw std::exception
+	void StartProfiler(unsigned frequency = 1000, int interval = 1000)
+	{
+		assert(lua != nullptr);
+		assert(frequency != 0);
+
+		StopProfiler();
+
+		if (!hooks)
+			hooks = std::make_unique<Hooks>();
+
+		if (!Hooks::UseSignal())
+			throw Exception("sigaction", errno);
+
+		auto flag = Hooks::AcquireSampleFlag();
+
+		if (flag == -1)
+			throw Exception("StartProfiler", "too many profilers running");
+
+		sigevent event              = {};
+		event.sigev_notify          = SIGEV_SIGNAL;
+		event.sigev_signo           = SIGPROF;
+		event.sigev_value.sival_int = flag;
+
+		if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &hooks->timer) == -1)
+		{
+			auto error = errno;
+
+			Hooks::ReleaseSampleFlag(&Hooks::GetSampleFlags()[flag]);
+
+			throw Exception("timer_create", error);
+		}
+
+		auto      period = 1000000000 / static_cast<long>(frequency);
+		itimerspec spec  = {};
+		spec.it_interval = { .tv_sec = period / 1000000000, .tv_nsec = period % 1000000000 };
+		spec.it_value    = spec.it_interval;
+
+		if (timer_settime(hooks->timer, 0, &spec, nullptr) == -1)
+		{
+			auto error = errno;
+
+			timer_delete(hooks->timer);
+			Hooks::ReleaseSampleFlag(&Hooks::GetSampleFlags()[flag]);
+
+			throw Exception("timer_settime", error);
+		}
 
-	LuaCPP(const LuaCPP&) = delete;
+		hooks->sample           = &Hooks::GetSampleFlags()[flag];
+		hooks->profile_interval = (interval > 0) ? interval : 1;
 
-public:
-	LuaCPP()
-		: lua(luaL_newstate()),
-		lua_is_owned(true)
-	{
-	}
-	LuaCPP(LuaCPP&& state)
-		: lua(state.lua),
-		lua_is_owned(state.lua_is_owned)
-	{
-		state.lua          = nullptr;
-		state.lua_is_owned = false;
+		UpdateHooks();
 	}
 
-	LuaCPP(lua_Alloc alloc, void* param)
-		: lua(lua_newstate(alloc, param, luaL_makeseed(nullptr))),
-		lua_is_owned(true)
+	void StopProfiler()
 	{
+		if (!hooks || (hooks->profile_interval == 0))
+			return;
+
+		timer_delete(hooks->timer);
+		Hooks::ReleaseSampleFlag(hooks->sample);
+
+		hooks->profile_interval = 0;
+		hooks->sample           = &Hooks::GetSampleFlags()[Hooks::SAMPLE_FLAG_COUNT];
+
+		UpdateHooks();
 	}
+#endif
 
-	LuaCPP(lua_State* state, bool take_ownership)
-		: lua(state),
-		lua_is_owned(take_ownership)
+	// @return samples as folded stacks, one "outer;...;inner count" line per distinct stack
+	std::string GetProfile() const
 	{
+		std::string profile;
+
+		if (hooks)
+			for (auto& [stack, count] : hooks->samples)
+				profile.append(stack).append(" ").append(std::to_string(count)).append("\n");
+
+		return profile;
 	}
 
-	virtual ~LuaCPP()
+	void ClearProfile()
 	{
-		Release();
+		if (hooks)
+			hooks->samples.clear();
 	}
 
-	// @throw std::exception
-	void Run(std::string_view lua)
+#if defined(LUACPP_INSTRUMENTATION)
+	// Bindings are counted per name passed to SetGlobal, process wide
+	static std::vector<BindingStats> GetBindingStats()
 	{
-		assert(this->lua != nullptr);
-
-		if (luaL_dostring(this->lua, lua.data()))
-			throw Exception("luaL_dostring", this->lua);
+		return Binding::GetSnapshot();
 	}
-	// @throw std::exception
-	void Run(const void* buffer, size_t size, std::string_view name)
-	{
-		assert(lua != nullptr);
 
-		if (luaL_loadbuffer(lua, (const char*)buffer, size, name.data()) != LUA_OK)
-			throw Exception("luaL_loadbuffer", lua);
+	// @return one "name calls=... peek=... body=... p50=... p99=... p999=... max=..." line per binding,
+	// peek and body are averages per call, all times in nanoseconds
+	static std::string DumpBindingStats()
+	{
+		std::string dump;
 
-		if (lua_pcall(lua, 0, 0, 0) != LUA_OK)
+		for (auto& stats : Binding::GetSnapshot())
 		{
-			lua_remove(lua, -2);
-
-			throw Exception("lua_pcall", lua);
+			auto average = [&stats](std::chrono::nanoseconds time)
+			{
+				return std::to_string((stats.calls != 0) ? (time.count() / static_cast<int64_t>(stats.calls)) : 0);
+			};
+
+			dump.append(stats.name)
+				.append(" calls=").append(std::to_string(stats.calls))
+				.append(" peek=").append(average(stats.peek_time))
+				.append(" body=").append(average(stats.body_time))
+				.append(" p50=").append(std::to_string(stats.GetPercentile(50).count()))
+				.append(" p99=").append(std::to_string(stats.GetPercentile(99).count()))
+				.append(" p999=").append(std::to_string(stats.GetPercentile(99.9).count()))
+				.append(" max=").append(std::to_string(stats.latency_max.count()))
+				.append("\n");
 		}
-	}
-	// @throw std::exception
-	// @return false if not found
-	bool RunFile(std::string_view path)
-	{
-		assert(lua != nullptr);
-
-		if (!FileExists(path))
-			return false;
 
-		if (luaL_dofile(lua, path.data()))
-			throw Exception("luaL_dofile", lua);
+		return dump;
+	}
 
-		return true;
+	static void ResetBindingStats()
+	{
+		Binding::Reset();
 	}
+#endif
 
 	void LoadLibrary(Libraries value)
 	{
@@ -691,120 +6663,121 @@ public:
 		if (luaL_loadstring(this->lua, lua.data()) != LUA_OK)
 			throw Exception("luaL_loadstring", this->lua);
 
-		auto writer = [](lua_State* lua, const void* buffer, size_t size, void* param)->int
-		{
-			((std::vector<uint8_t>*)param)->resize(size);
-			memcpy(((std::vector<uint8_t>*)param)->data(), buffer, size);
-
-			return LUA_OK;
-		};
-
-		int result;
+		buffer.clear();
+		// bytecode is usually within the size of its source
+		buffer.reserve(lua.size());
 
-		if ((result = lua_dump(this->lua, writer, &buffer, include_debug_information ? 0 : 1)) != LUA_OK)
+		Dump([&buffer](const void* data, size_t size)
 		{
-			lua_pop(this->lua, 1);
+			buffer.insert(buffer.end(), (const uint8_t*)data, (const uint8_t*)data + size);
 
-			throw Exception("lua_dump", result);
-		}
+			return true;
+		}, include_debug_information);
 
 		return true;
 	}
 	// @throw std::exception
-	// @return false if not found
-	bool Compile(std::string_view lua, std::string_view destination, bool include_debug_information)
+	// @return number of bytes written
+	size_t Compile(std::string_view lua, std::span<uint8_t> buffer, bool include_debug_information)
 	{
 		assert(this->lua != nullptr);
 
 		if (luaL_loadstring(this->lua, lua.data()) != LUA_OK)
 			throw Exception("luaL_loadstring", this->lua);
 
-		struct Context
-		{
-			std::ofstream stream;
-			Exception     exception;
-			bool          exception_is_set;
-		};
+		return DumpToSpan(buffer, include_debug_information);
+	}
+	// @throw std::exception
+	// @return false if not found
+	bool Compile(std::string_view lua, std::string_view destination, bool include_debug_information)
+	{
+		assert(this->lua != nullptr);
 
-		Context context = {};
+		if (luaL_loadstring(this->lua, lua.data()) != LUA_OK)
+			throw Exception("luaL_loadstring", this->lua);
 
-		context.stream.exceptions(std::ios::failbit | std::ios::badbit);
+		DumpToFile(destination, include_debug_information);
 
-		try
-		{
-			context.stream.open(destination.data(), std::ios::out | std::ios::trunc | std::ios::binary);
-		}
-		catch (const std::exception& exception)
-		{
-			lua_pop(this->lua, 1);
+		return true;
+	}
+	// @throw std::exception
+	// @param sink bool(const void* buffer, size_t size) called for every block, false aborts the dump
+	template<typename F>
+		requires std::is_invocable_r<bool, F, const void*, size_t>::value
+	void Compile(std::string_view lua, F&& sink, bool include_debug_information)
+	{
+		assert(this->lua != nullptr);
 
-			throw Exception("std::ofstream::open", exception.what());
-		}
+		if (luaL_loadstring(this->lua, lua.data()) != LUA_OK)
+			throw Exception("luaL_loadstring", this->lua);
 
-		auto writer = [](lua_State* lua, const void* buffer, size_t size, void* param)->int
-		{
-			auto context = (Context*)param;
+		Dump(std::forward<F>(sink), include_debug_information);
+	}
+	// @throw std::exception
+	// @return false if not found
+	bool CompileFile(std::string_view source, std::vector<uint8_t>& buffer, bool include_debug_information)
+	{
+		assert(lua != nullptr);
 
-			try
-			{
-				context->stream.write((const char*)buffer, size);
-			}
-			catch (const std::exception& exception)
-			{
-				context->exception        = Exception("std::ofstream::write", exception.what());
-				context->exception_is_set = true;
+		if (!FileExists(source))
+			return false;
 
-				return LUA_ERRERR;
-			}
+		if (luaL_loadfile(lua, source.data()) != LUA_OK)
+			throw Exception("luaL_loadfile", lua);
 
-			return LUA_OK;
-		};
+		std::error_code error;
 
-		int result;
+		buffer.clear();
+		// bytecode is usually within the size of its source
+		if (auto size = std::filesystem::file_size(source, error); !error)
+			buffer.reserve(static_cast<size_t>(size));
 
-		if ((result = lua_dump(this->lua, writer, &context, include_debug_information ? 0 : 1)) != LUA_OK)
+		Dump([&buffer](const void* data, size_t size)
 		{
-			lua_pop(this->lua, 1);
+			buffer.insert(buffer.end(), (const uint8_t*)data, (const uint8_t*)data + size);
 
-			throw Exception("lua_dump", result);
-		}
+			return true;
+		}, include_debug_information);
 
 		return true;
 	}
 	// @throw std::exception
-	// @return false if not found
-	bool CompileFile(std::string_view source, std::vector<uint8_t>& buffer, bool include_debug_information)
+	// @return 0 if not found
+	// @return number of bytes written
+	size_t CompileFile(std::string_view source, std::span<uint8_t> buffer, bool include_debug_information)
 	{
 		assert(lua != nullptr);
 
 		if (!FileExists(source))
-			return false;
-
-		if (luaL_loadfile(this->lua, source.data()) != LUA_OK)
-			throw Exception("luaL_loadfile", this->lua);
+			return 0;
 
-		auto writer = [](lua_State* lua, const void* buffer, size_t size, void* param)->int
-		{
-			((std::vector<uint8_t>*)param)->resize(size);
-			memcpy(((std::vector<uint8_t>*)param)->data(), buffer, size);
+		if (luaL_loadfile(lua, source.data()) != LUA_OK)
+			throw Exception("luaL_loadfile", lua);
 
-			return LUA_OK;
-		};
+		return DumpToSpan(buffer, include_debug_information);
+	}
+	// @throw std::exception
+	// @return false if not found
+	bool CompileFile(std::string_view source, std::string_view destination, bool include_debug_information)
+	{
+		assert(lua != nullptr);
 
-		int result;
+		if (!FileExists(source))
+			return false;
 
-		if ((result = lua_dump(lua, writer, &buffer, include_debug_information ? 0 : 1)) != LUA_OK)
-		{
-			lua_pop(lua, 1);
+		if (luaL_loadfile(lua, source.data()) != LUA_OK)
+			throw Exception("luaL_loadfile", lua);
 
-			throw Exception("lua_dump", result);
-		}
+		DumpToFile(destination, include_debug_information);
 
 		return true;
 	}
 	// @throw std::exception
+	// @param sink bool(const void* buffer, size_t size) called for every block, false aborts the dump
 	// @return false if not found
-	bool CompileFile(std::string_view source, std::string_view destination, bool include_debug_information)
+	template<typename F>
+		requires std::is_invocable_r<bool, F, const void*, size_t>::value
+	bool CompileFile(std::string_view source, F&& sink, bool include_debug_information)
 	{
 		assert(lua != nullptr);
 
@@ -814,118 +6787,226 @@ public:
 		if (luaL_loadfile(lua, source.data()) != LUA_OK)
 			throw Exception("luaL_loadfile", lua);
 
-		struct Context
-		{
-			std::ofstream stream;
-			Exception     exception;
-			bool          exception_is_set;
-		};
+		Dump(std::forward<F>(sink), include_debug_information);
+
+		return true;
+	}
+
+	// Encodes the value at index, see Serializer for what is supported
+	// @throw std::exception
+	void   Serialize(int index, std::vector<uint8_t>& buffer)
+	{
+		assert(lua != nullptr);
+
+		Serializer::Serialize(lua, index, buffer);
+	}
+	// @throw std::exception
+	// @return number of bytes written
+	size_t Serialize(int index, std::span<uint8_t> buffer)
+	{
+		assert(lua != nullptr);
+
+		return Serializer::Serialize(lua, index, buffer);
+	}
+	// Pushes the decoded value
+	// @throw std::exception
+	void   Deserialize(std::span<const uint8_t> buffer)
+	{
+		assert(lua != nullptr);
+
+		Serializer::Deserialize(lua, buffer);
+	}
 
-		Context context = {};
+	// @throw std::exception
+	void   SerializeGlobal(std::string_view name, std::vector<uint8_t>& buffer)
+	{
+		assert(lua != nullptr);
 
-		context.stream.exceptions(std::ios::failbit | std::ios::badbit);
+		lua_getglobal(lua, name.data());
 
 		try
 		{
-			context.stream.open(destination.data(), std::ios::out | std::ios::trunc | std::ios::binary);
+			Serializer::Serialize(lua, -1, buffer);
 		}
-		catch (const std::exception& exception)
+		catch (...)
 		{
 			lua_pop(lua, 1);
 
-			throw Exception("std::ofstream::open", exception.what());
+			throw;
 		}
 
-		auto writer = [](lua_State* lua, const void* buffer, size_t size, void* param)->int
+		lua_pop(lua, 1);
+	}
+	// @throw std::exception
+	void   DeserializeGlobal(std::string_view name, std::span<const uint8_t> buffer)
+	{
+		assert(lua != nullptr);
+
+		Serializer::Deserialize(lua, buffer);
+		lua_setglobal(lua, name.data());
+	}
+
+	// @return 0 on not found
+	// @return -1 on invalid type
+	template<typename T>
+	int  GetGlobal(std::string_view name, T& value) const
+	{
+		assert(lua != nullptr);
+
+		static_assert(Get_Type<T>::Value != Types::None);
+
+		auto type = lua_getglobal(lua, name.data());
+
+		if (type == LUA_TNONE)
+			return 0;
+
+		if (type != static_cast<int>(Get_Type<T>::Value))
 		{
-			auto context = (Context*)param;
+			Pop(lua);
 
-			try
-			{
-				context->stream.write((const char*)buffer, size);
-			}
-			catch (const std::exception& exception)
+			return -1;
+		}
+
+		return Pop<T>(lua, value) ? 1 : 0;
+	}
+
+	auto GetGlobalType(std::string_view name) const
+	{
+		assert(lua != nullptr);
+
+		auto type = lua_getglobal(lua, name.data());
+
+		if (type != LUA_TNONE)
+			Pop(lua);
+
+		return static_cast<Types>(type);
+	}
+
+	template<auto VALUE>
+	void SetGlobal(std::string_view name)
+	{
+		assert(lua != nullptr);
+
+		if constexpr (Is_CFunction<decltype(VALUE)>::Value)
+		{
+#if defined(LUACPP_INSTRUMENTATION)
+			lua_pushlightuserdata(lua, Binding::Register(name));
+			lua_pushcclosure(lua, &CFunction<VALUE>::Execute, 1);
+#else
+			lua_pushcclosure(lua, &CFunction<VALUE>::Execute, 0);
+#endif
+			lua_setglobal(lua, name.data());
+		}
+		else
+			return SetGlobal(name, VALUE);
+	}
+	template<typename T>
+	void SetGlobal(std::string_view name, const T& value)
+	{
+		assert(lua != nullptr);
+
+		static_assert(!Is_CFunction<T>::Value);
+		static_assert(Get_Type<T>::Value != Types::None);
+
+#if defined(LUACPP_INSTRUMENTATION)
+		// the Binding goes into the closure, the context is shared by every copy of the Function
+		if constexpr (Is_Function<T>::Value)
+		{
+			if (value.GetType() == FunctionTypes::C)
 			{
-				context->exception        = Exception("std::ofstream::write", exception.what());
-				context->exception_is_set = true;
+				lua_pushlightuserdata(lua, value.context.get());
+				lua_pushlightuserdata(lua, Binding::Register(name));
+				lua_pushcclosure(lua, &T::ExecuteC, 2);
+				lua_setglobal(lua, name.data());
 
-				return LUA_ERRERR;
+				return;
 			}
+		}
+#endif
 
-			return LUA_OK;
-		};
+		Push<T>(lua, value);
+		lua_setglobal(lua, name.data());
+	}
 
-		int result;
+	// Binds T as the metatable of UserData<T>, a Constructor registers a global factory named after the class
+	// e.g. RegisterClass<Vector, Constructor<float, float>, Method<"Length", &Vector::Length>, Property<"x", &Vector::x>>("Vector")
+	template<typename T, typename ... TMembers>
+	void RegisterClass(std::string_view name)
+	{
+		assert(lua != nullptr);
 
-		if ((result = lua_dump(lua, writer, &context, include_debug_information ? 0 : 1)) != LUA_OK)
-		{
-			lua_pop(lua, 1);
+		typedef decltype(std::tuple_cat(std::declval<typename std::conditional<Is_Constructor<TMembers>::Value, std::tuple<>, std::tuple<TMembers>>::type>() ...)) Members;
+		typedef decltype(std::tuple_cat(std::declval<typename std::conditional<Is_Constructor<TMembers>::Value, std::tuple<TMembers>, std::tuple<>>::type>() ...)) Constructors;
 
-			throw Exception("lua_dump", result);
-		}
+		ClassBinding<T, Members, Constructors>::Register(lua, name);
 
-		return true;
+		if constexpr (std::is_trivially_copyable<T>::value)
+			Serializer::Register<T>(name);
 	}
 
-	// @return 0 on not found
-	// @return -1 on invalid type
-	template<typename T>
-	int  GetGlobal(std::string_view name, T& value) const
+	// @param array_size pre-allocated array slots
+	// @param hash_size pre-allocated hash slots
+	auto CreateTable(int array_size = 0, int hash_size = 0)
 	{
 		assert(lua != nullptr);
 
-		static_assert(Get_Type<T>::Value != Types::None);
+		return Table::Create(lua, array_size, hash_size);
+	}
 
-		auto type = lua_getglobal(lua, name.data());
+	// @param function global function the coroutine runs on its first Resume
+	// @throw std::exception
+	auto CreateThread(std::string_view function)
+	{
+		assert(lua != nullptr);
 
-		if (type == LUA_TNONE)
-			return 0;
+		auto thread = Thread::Create(lua);
 
-		if (type != static_cast<int>(Get_Type<T>::Value))
+		if (int type = lua_getglobal(thread.GetState(), function.data()); type != LUA_TFUNCTION)
 		{
-			Pop(lua);
+			lua_pop(thread.GetState(), 1);
 
-			return -1;
+			throw Exception("lua_getglobal", type);
 		}
 
-		return Pop<T>(lua, value) ? 1 : 0;
+		return thread;
 	}
 
-	auto GetGlobalType(std::string_view name) const
+	// Yields the running coroutine from a raw lua_CFunction without blocking the OS thread.
+	// CONTINUATION, if any, runs in place of the C function once the coroutine is resumed.
+	// lua_yieldk unwinds the calling frame, so no C++ object may be alive in it. Bound C++
+	// functions return Yielding instead.
+	// @param result_count values on top of the stack passed to the resumer
+	template<lua_KFunction CONTINUATION = nullptr>
+	static int Yield(lua_State* lua, int result_count, lua_KContext context = 0)
 	{
-		assert(lua != nullptr);
-
-		auto type = lua_getglobal(lua, name.data());
+		return lua_yieldk(lua, result_count, context, CONTINUATION);
+	}
 
-		if (type != LUA_TNONE)
-			Pop(lua);
+	// @param span memory that must outlive the view, or be detached with Release/Reset first
+	template<typename T>
+	auto CreateArrayView(std::span<T> span)
+	{
+		assert(lua != nullptr);
 
-		return static_cast<Types>(type);
+		return ArrayView<T>(lua, span);
 	}
 
-	template<auto VALUE>
-	void SetGlobal(std::string_view name)
+	// @throw std::exception
+	template<typename T, typename ... TArgs>
+	auto CreateUserData(TArgs&& ... args)
 	{
 		assert(lua != nullptr);
 
-		if constexpr (Is_CFunction<decltype(VALUE)>::Value)
-		{
-			lua_pushcclosure(lua, &CFunction<VALUE>::Execute, 0);
-			lua_setglobal(lua, name.data());
-		}
-		else
-			return SetGlobal(name, VALUE);
+		return UserData<T>::Create(lua, std::forward<TArgs>(args) ...);
 	}
+
+	// @param pin_value resolve the value once and serve reads from the registry
 	template<typename T>
-	void SetGlobal(std::string_view name, const T& value)
+	auto GetGlobalRef(std::string_view name, bool pin_value = Is_Function<T>::Value) const
 	{
 		assert(lua != nullptr);
 
-		static_assert(!Is_CFunction<T>::Value);
-		static_assert(Get_Type<T>::Value != Types::None);
-
-		Push<T>(lua, value);
-		lua_setglobal(lua, name.data());
+		return GlobalRef<T>(lua, name, pin_value);
 	}
 
 	void RemoveGlobal(std::string_view name)
@@ -936,16 +7017,64 @@ public:
 		lua_setglobal(lua, name.data());
 	}
 
+	// @return nullptr if the state was not created with an AccountingAllocator
+	const MemoryStats* GetMemoryStats() const
+	{
+		if (auto allocator = GetAccountingAllocator())
+			return &allocator->GetStats();
+
+		return nullptr;
+	}
+
+	// @param value 0 to disable
+	// @return false if the state was not created with an AccountingAllocator
+	bool SetMemoryLimit(size_t value)
+	{
+		if (auto allocator = GetAccountingAllocator())
+		{
+			allocator->SetLimit(value);
+
+			return true;
+		}
+
+		return false;
+	}
+
 	void Release()
 	{
+		if (chunk_cache)
+		{
+			// lua_close drops the references of owned states
+			if (lua && !lua_is_owned)
+				chunk_cache->Clear(lua);
+
+			chunk_cache.reset();
+		}
+
+#if defined(__linux__)
+		if (lua)
+			StopProfiler();
+#endif
+
 		if (lua)
 		{
 			if (lua_is_owned)
 				lua_close(lua);
+			// the state outlives us, stop it from reaching the hook state
+			else if (hooks)
+			{
+				hooks->instructions = 0;
+				hooks->time         = std::chrono::nanoseconds(0);
+
+				UpdateHooks();
+			}
 
 			lua          = nullptr;
 			lua_is_owned = false;
 		}
+
+		hooks.reset();
+		gc_stats.reset();
 	}
 
 	constexpr operator bool() const
@@ -960,8 +7089,7 @@ public:
 
 	auto& operator = (LuaCPP&& state)
 	{
-		if (lua && lua_is_owned)
-			lua_close(lua);
+		Release();
 
 		lua = state.lua;
 		state.lua = nullptr;
@@ -969,6 +7097,10 @@ public:
 		lua_is_owned = state.lua_is_owned;
 		state.lua_is_owned = false;
 
+		chunk_cache = std::move(state.chunk_cache);
+		hooks       = std::move(state.hooks);
+		gc_stats    = std::move(state.gc_stats);
+
 		return *this;
 	}
 
@@ -993,6 +7125,10 @@ private:
 		if (!Peek(lua, 1, value))
 			return false;
 
+		// the stack slot a borrowed handle points to is about to go away
+		if constexpr (Is_Borrowed<T>::Value)
+			value.Pin();
+
 		lua_pop(lua, 1);
 
 		return true;
@@ -1079,13 +7215,120 @@ private:
 				return true;
 			}
 		}
+		else if constexpr (Is_AnchoredString<T>::Value)
+		{
+			// numbers are converted in place, so the slot anchors the resulting string
+			if (size_t length; auto string = lua_tolstring(lua, static_cast<int>(index), &length))
+			{
+				value = T(lua, lua_absindex(lua, static_cast<int>(index)), std::string_view(string, length));
+
+				return true;
+			}
+		}
+		else if constexpr (Is_Table<T>::Value)
+		{
+			if (lua_type(lua, static_cast<int>(index)) == LUA_TTABLE)
+			{
+				value = T(lua, lua_absindex(lua, static_cast<int>(index)));
+
+				return true;
+			}
+		}
+		else if constexpr (Is_Vector<T>::Value)
+		{
+			if ((lua_type(lua, static_cast<int>(index)) != LUA_TTABLE) || !lua_checkstack(lua, 1))
+				return false;
+
+			auto size = static_cast<lua_Integer>(lua_rawlen(lua, static_cast<int>(index)));
+
+			value.clear();
+			value.reserve(static_cast<size_t>(size));
+
+			for (lua_Integer i = 1; i <= size; ++i)
+			{
+				typename T::value_type item;
+
+				lua_rawgeti(lua, static_cast<int>(index), i);
+
+				bool result = Peek(lua, lua_gettop(lua), item);
+
+				if constexpr (Is_Borrowed<typename T::value_type>::Value)
+					item.Pin();
+
+				lua_pop(lua, 1);
+
+				if (!result)
+					return false;
+
+				value.push_back(std::move(item));
+			}
+
+			return true;
+		}
+		else if constexpr (Is_Map<T>::Value)
+		{
+			if ((lua_type(lua, static_cast<int>(index)) != LUA_TTABLE) || !lua_checkstack(lua, 3))
+				return false;
+
+			value.clear();
+
+			for (lua_pushnil(lua); lua_next(lua, static_cast<int>(index)); )
+			{
+				typename T::key_type    key;
+				typename T::mapped_type item;
+
+				// peek a copy so string conversion can't confuse lua_next
+				lua_pushvalue(lua, -2);
+
+				auto top    = lua_gettop(lua);
+				bool result = Peek(lua, top, key) && Peek(lua, top - 1, item);
+
+				if constexpr (Is_Borrowed<typename T::key_type>::Value)
+					key.Pin();
+
+				if constexpr (Is_Borrowed<typename T::mapped_type>::Value)
+					item.Pin();
+
+				lua_pop(lua, 2);
+
+				if (!result)
+				{
+					lua_pop(lua, 1);
+
+					return false;
+				}
+
+				value.emplace(std::move(key), std::move(item));
+			}
+
+			return true;
+		}
 		else if constexpr (Is_Thread<T>::Value)
 		{
-			// TODO: implement
+			if (auto thread = lua_tothread(lua, static_cast<int>(index)))
+			{
+				value = T(lua, thread, lua_absindex(lua, static_cast<int>(index)));
+
+				return true;
+			}
 		}
 		else if constexpr (Is_UserData<T>::Value)
 		{
-			// TODO: implement
+			if (auto block = T::ToBlock(lua, static_cast<int>(index)))
+			{
+				value = T(lua, block, lua_absindex(lua, static_cast<int>(index)));
+
+				return true;
+			}
+		}
+		else if constexpr (Is_ArrayView<T>::Value)
+		{
+			if (auto block = T::TryToBlock(lua, static_cast<int>(index)))
+			{
+				value = T(lua, block, lua_absindex(lua, static_cast<int>(index)));
+
+				return true;
+			}
 		}
 		else if constexpr (Is_LightUserData<T>::Value)
 		{
@@ -1167,42 +7410,69 @@ private:
 		}
 		else if constexpr (Is_String<T>::Value)
 		{
+			// the memory behind borrowed strings may not outlive the Lua string, ExternalString hands it over instead
 			if constexpr (Is_CString<T>::Value)
 			{
 				if (value == nullptr)
 					lua_pushnil(lua);
 				else
-				{
-#if defined(LUACPP_IS_LUA54)
 					lua_pushstring(lua, value);
-#elif defined(LUACPP_IS_LUA55)
-					lua_pushexternalstring(lua, value, strlen(value), nullptr, nullptr);
-#endif
-				}
 			}
 			else if constexpr (Is_StringView<T>::Value)
 			{
 				if (value.data() == nullptr)
 					lua_pushnil(lua);
 				else
-#if defined(LUACPP_IS_LUA54)
 					lua_pushlstring(lua, value.data(), value.length());
-#elif defined(LUACPP_IS_LUA55)
-					lua_pushexternalstring(lua, value.data(), value.length(), nullptr, nullptr);
-#endif
 			}
 			else
 				lua_pushlstring(lua, value.c_str(), value.length());
 
 			return 1;
 		}
-		else if constexpr (Is_Thread<T>::Value)
+		else if constexpr (Is_Table<T>::Value || Is_AnchoredString<T>::Value || Is_ExternalString<T>::Value)
+		{
+			value.PushValue(lua);
+
+			return 1;
+		}
+		else if constexpr (Is_Vector<T>::Value)
 		{
-			// TODO: implement
+			static_assert(Get_Type<typename T::value_type>::Value != Types::None);
+
+			lua_createtable(lua, static_cast<int>(value.size()), 0);
+
+			lua_Integer i = 0;
+
+			for (const auto& item : value)
+			{
+				Push(lua, item);
+				lua_rawseti(lua, -2, ++i);
+			}
+
+			return 1;
 		}
-		else if constexpr (Is_UserData<T>::Value)
+		else if constexpr (Is_Map<T>::Value)
+		{
+			static_assert(Get_Type<typename T::key_type>::Value != Types::None);
+			static_assert(Get_Type<typename T::mapped_type>::Value != Types::None);
+
+			lua_createtable(lua, 0, static_cast<int>(value.size()));
+
+			for (const auto& item : value)
+			{
+				Push(lua, item.first);
+				Push(lua, item.second);
+				lua_rawset(lua, -3);
+			}
+
+			return 1;
+		}
+		else if constexpr (Is_Thread<T>::Value || Is_UserData<T>::Value || Is_ArrayView<T>::Value || Is_Channel<T>::Value || Is_InlineFunction<T>::Value)
 		{
-			// TODO: implement
+			value.PushValue(lua);
+
+			return 1;
 		}
 		else if constexpr (Is_LightUserData<T>::Value)
 		{
@@ -1213,6 +7483,8 @@ private:
 
 			return 1;
 		}
+		else if constexpr (Is_Yielding<T>::Value)
+			return std::apply([lua](const auto& ... values) { return (0 + ... + Push(lua, values)); }, value.values);
 
 		return 0;
 	}
@@ -1255,15 +7527,159 @@ private:
 	}
 
 private:
+#if defined(LUACPP_IS_LUA55)
+	// @param value 0 keeps the current value
+	void SetGCParameter(int parameter, int value)
+	{
+		if (value != 0)
+			lua_gc(lua, LUA_GCPARAM, parameter, value);
+	}
+#endif
+
+	// Installs the count hook while a budget or the profiler needs it
+	void UpdateHooks()
+	{
+		bool is_budgeted = hooks->IsBudgeted();
+		bool is_profiled = hooks->profile_interval != 0;
+
+		if (!is_budgeted && !is_profiled)
+		{
+			lua_sethook(lua, nullptr, 0, 0);
+			lua_pushnil(lua);
+			lua_rawsetp(lua, LUA_REGISTRYINDEX, &Hooks::KEY);
+
+			return;
+		}
+
+		hooks->interval = (is_budgeted && is_profiled) ? (std::min)(hooks->budget_interval, hooks->profile_interval) :
+			is_budgeted ? hooks->budget_interval : hooks->profile_interval;
+
+		lua_pushlightuserdata(lua, hooks.get());
+		lua_rawsetp(lua, LUA_REGISTRYINDEX, &Hooks::KEY);
+		lua_sethook(lua, &Hooks::Execute, LUA_MASKCOUNT, hooks->interval);
+	}
+
+	// Throws the error on top of the stack, typed if a budget ran out
 	// @throw std::exception
-	static bool FileExists(std::string_view path)
+	[[noreturn]] static void ThrowError(std::string_view function, lua_State* lua)
 	{
-		if (!std::filesystem::exists(path))
-			return false;
+		// a script may have caught the budget error and raised something else
+		if (auto hooks = Hooks::Get(lua); (hooks != nullptr) && (hooks->exceeded != Budgets::None) && Hooks::IsError(lua, -1))
+			throw BudgetException(function, lua, hooks->exceeded);
 
-		if (!std::filesystem::is_regular_file(path) && !std::filesystem::is_symlink(path))
-			return false;
+		throw Exception(function, lua);
+	}
 
-		return true;
+	// Dumps and pops the function on top of the stack
+	// @throw std::exception
+	template<typename F>
+	void   Dump(F&& sink, bool include_debug_information)
+	{
+		struct Context
+		{
+			F&                 sink;
+			std::exception_ptr exception;
+		};
+
+		Context context = { sink };
+
+		auto writer = [](lua_State* lua, const void* buffer, size_t size, void* param)->int
+		{
+			auto context = (Context*)param;
+
+			try
+			{
+				if (!context->sink(buffer, size))
+					return LUA_ERRERR;
+			}
+			catch (...)
+			{
+				context->exception = std::current_exception();
+
+				return LUA_ERRERR;
+			}
+
+			return LUA_OK;
+		};
+
+		int result = lua_dump(lua, writer, &context, include_debug_information ? 0 : 1);
+
+		lua_pop(lua, 1);
+
+		if (context.exception)
+			std::rethrow_exception(context.exception);
+
+		if (result != LUA_OK)
+			throw Exception("lua_dump", result);
+	}
+	// @throw std::exception
+	size_t DumpToSpan(std::span<uint8_t> buffer, bool include_debug_information)
+	{
+		size_t size = 0;
+
+		Dump([&buffer, &size](const void* data, size_t data_size)
+		{
+			if (data_size > (buffer.size() - size))
+				throw Exception("lua_dump", "buffer too small");
+
+			std::memcpy(&buffer[size], data, data_size);
+			size += data_size;
+
+			return true;
+		}, include_debug_information);
+
+		return size;
+	}
+	// @throw std::exception
+	void   DumpToFile(std::string_view destination, bool include_debug_information)
+	{
+		std::ofstream stream;
+
+		stream.exceptions(std::ios::failbit | std::ios::badbit);
+
+		try
+		{
+			stream.open(destination.data(), std::ios::out | std::ios::trunc | std::ios::binary);
+		}
+		catch (const std::exception& exception)
+		{
+			lua_pop(lua, 1);
+
+			throw Exception("std::ofstream::open", exception.what());
+		}
+
+		Dump([&stream](const void* data, size_t size)
+		{
+			try
+			{
+				stream.write((const char*)data, size);
+			}
+			catch (const std::exception& exception)
+			{
+				throw Exception("std::ofstream::write", exception.what());
+			}
+
+			return true;
+		}, include_debug_information);
+	}
+
+	AccountingAllocator* GetAccountingAllocator() const
+	{
+		assert(lua != nullptr);
+
+		void* param;
+
+		if (lua_getallocf(lua, &param) != &AccountingAllocator::Alloc)
+			return nullptr;
+
+		return reinterpret_cast<AccountingAllocator*>(param);
+	}
+
+	static bool FileExists(std::string_view path)
+	{
+		std::error_code error;
+
+		// single stat, symlinks are followed
+		return std::filesystem::is_regular_file(std::filesystem::status(path, error));
 	}
 };
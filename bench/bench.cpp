@@ -0,0 +1,645 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#include <LuaCPP.hpp>
+
+#if defined(__linux__)
+	#include <sys/socket.h>
+#endif
+
+struct Result
+{
+	std::string name;
+	size_t      iterations;
+	double      ns_per_op;
+	double      mib_per_s;
+};
+
+std::vector<Result> results;
+
+// @param bytes bytes processed per iteration, 0 to skip the throughput column
+template<typename F>
+void benchmark(std::string_view name, size_t iterations, F&& function, size_t bytes = 0)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < iterations; ++i)
+		function();
+
+	auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+	auto& result = results.emplace_back(Result { std::string(name), iterations, elapsed.count() / iterations, 0 });
+
+	std::cout << LUA_RELEASE << " " << name << ": " << result.ns_per_op << " ns/op";
+
+	if (bytes != 0)
+	{
+		result.mib_per_s = (bytes * iterations) / (elapsed.count() / 1e9) / (1024 * 1024);
+
+		std::cout << ", " << result.mib_per_s << " MiB/s";
+	}
+
+	std::cout << std::endl;
+}
+
+// { "lua": "Lua 5.4.7", "results": [ { "name": ..., "iterations": ..., "ns_per_op": ..., "mib_per_s": ... }, ... ] }
+// mib_per_s is 0 for benchmarks without a throughput
+bool write_json(const std::string& path)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+	if (!file)
+		return false;
+
+	file << "{\n\t\"lua\": \"" << LUA_RELEASE << "\",\n\t\"results\": [";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		file << (i ? ",\n" : "\n") << "\t\t{ \"name\": \"" << results[i].name << "\", \"iterations\": " << results[i].iterations
+			<< ", \"ns_per_op\": " << results[i].ns_per_op << ", \"mib_per_s\": " << results[i].mib_per_s << " }";
+	}
+
+	file << "\n\t]\n}\n";
+
+	return static_cast<bool>(file);
+}
+
+// Push through SetGlobal, Pop through GetGlobal and Peek through Table::Get
+template<typename T>
+void benchmark_marshal(LuaCPP& lua, LuaCPP::Table& table, std::string_view type, const T& value)
+{
+	T    result;
+	auto name = std::string("marshal.").append(type);
+
+	benchmark(name + ".push", 100000, [&lua, &value]() { lua.SetGlobal("value", value); });
+	benchmark(name + ".pop", 100000, [&lua, &result]() { lua.GetGlobal("value", result); });
+
+	table.Set(1, value);
+
+	benchmark(name + ".peek", 100000, [&table, &result]() { table.Get(1, result); });
+}
+
+// ~size bytes of distinct functions
+std::string generate_source(size_t size)
+{
+	std::string source;
+
+	for (size_t i = 0; source.size() < size; ++i)
+		source.append("function f").append(std::to_string(i)).append("(a, b) local t = { a, b, 'f").append(std::to_string(i)).append("' } return #t + a * b end\n");
+
+	return source;
+}
+
+struct Counter
+{
+	int64_t value = 0;
+
+	int64_t Add(int64_t amount)
+	{
+		return value += amount;
+	}
+};
+
+struct CounterWithProperties
+	: public Counter
+{
+};
+
+int64_t add(int64_t a, int64_t b)
+{
+	return a + b;
+}
+
+int64_t length_copied(std::string payload)
+{
+	return static_cast<int64_t>(payload.size());
+}
+
+int64_t length_anchored(LuaCPP::AnchoredString payload)
+{
+	return static_cast<int64_t>(payload.GetSize());
+}
+
+#if defined(__linux__)
+// @return false once the peer hung up
+bool drain(int64_t fd)
+{
+	char buffer[256];
+
+	return read(static_cast<int>(fd), buffer, sizeof(buffer)) > 0;
+}
+
+void print_latency(std::string_view name, const LuaCPP::Scheduler::Stats& stats)
+{
+	std::cout << LUA_RELEASE << " " << name << " latency: "
+		<< (stats.resumes ? (stats.latency.count() / stats.resumes) : 0) << " ns mean, "
+		<< stats.latency_max.count() << " ns max, buckets (<2^i us):";
+
+	for (auto count : stats.latency_histogram)
+		std::cout << " " << count;
+
+	std::cout << std::endl;
+}
+#endif
+
+static constexpr const char* CHURN_SCRIPT = R"(
+	local t = {}
+	for i = 1, 100000 do
+		t[i % 512 + 1] = { x = i, y = tostring(i), z = function() return i end }
+	end
+)";
+
+// usage: bench [--json <path>]
+int main(int argc, char* argv[])
+{
+	std::string json_path;
+
+	for (int i = 1; i < argc; ++i)
+		if ((std::string_view(argv[i]) == "--json") && (i + 1 < argc))
+			json_path = argv[++i];
+
+	try
+	{
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.RegisterClass<Counter, LuaCPP::Constructor<>, LuaCPP::Method<"Add", &Counter::Add>>("Counter");
+			lua.Run("function identity(x) return x end");
+
+			auto table = lua.CreateTable(1);
+			table.Pin();
+
+			std::vector<int64_t>           vector(16, 1);
+			std::map<std::string, int64_t> map;
+
+			for (size_t i = 0; i < 16; ++i)
+				map.emplace(std::to_string(i), static_cast<int64_t>(i));
+
+			LuaCPP::Function<int64_t(int64_t)> function;
+			lua.GetGlobal("identity", function);
+
+			auto thread   = lua.CreateThread("identity");
+			auto userdata = lua.CreateUserData<Counter>();
+			auto element  = lua.CreateTable();
+			thread.Pin();
+			userdata.Pin();
+			element.Pin();
+
+			benchmark_marshal(lua, table, "boolean", true);
+			benchmark_marshal(lua, table, "integer", int64_t(42));
+			benchmark_marshal(lua, table, "number", 42.0);
+			benchmark_marshal(lua, table, "string", std::string("the quick brown fox"));
+			benchmark_marshal(lua, table, "string_view", std::string_view("the quick brown fox"));
+			benchmark_marshal(lua, table, "cstring", static_cast<const char*>("the quick brown fox"));
+			benchmark_marshal(lua, table, "lightuserdata", static_cast<void*>(&vector));
+			benchmark_marshal(lua, table, "table", element);
+			benchmark_marshal(lua, table, "vector", vector);
+			benchmark_marshal(lua, table, "map", map);
+			benchmark_marshal(lua, table, "thread", thread);
+			benchmark_marshal(lua, table, "userdata", userdata);
+			benchmark_marshal(lua, table, "function", function);
+
+			lua.RemoveGlobal("value");
+		}
+
+		benchmark("allocator.default.state", 1000, []()
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+		});
+
+		benchmark("allocator.slab.state", 1000, []()
+		{
+			LuaCPP::SlabAllocator allocator;
+			LuaCPP lua(allocator);
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+		});
+
+		benchmark("allocator.default.churn", 20, []()
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.Run(CHURN_SCRIPT);
+		});
+
+		benchmark("allocator.slab.churn", 20, []()
+		{
+			LuaCPP::SlabAllocator allocator;
+			LuaCPP lua(allocator);
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.Run(CHURN_SCRIPT);
+		});
+
+		for (size_t chunk_cache_capacity : { 0, 16 })
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.EnableChunkCache(chunk_cache_capacity);
+
+			benchmark(chunk_cache_capacity ? "run.cached" : "run.uncached", 10000, [&lua]()
+			{
+				lua.Run("local t = {} for i = 1, 16 do t[i] = string.format('%d', i) end return #t");
+				lua_settop(lua, 0);
+			});
+		}
+
+		{
+			LuaCPP               lua;
+			std::vector<uint8_t> bytecode;
+			auto                 source        = generate_source(64 * 1024);
+			auto                 directory     = std::filesystem::temp_directory_path();
+			auto                 source_path   = (directory / "luacpp_bench.lua").string();
+			auto                 bytecode_path = (directory / "luacpp_bench.luac").string();
+
+			std::ofstream(source_path, std::ios::binary | std::ios::trunc) << source;
+			lua.Compile(source, bytecode, false);
+			lua.Compile(source, std::string_view(bytecode_path), false);
+
+			benchmark("load.run", 100, [&lua, &source]() { lua.Run(source); }, source.size());
+			benchmark("load.run_file", 100, [&lua, &source_path]() { lua.RunFile(source_path); }, source.size());
+			benchmark("load.run_bytecode", 100, [&lua, &bytecode]() { lua.Run(bytecode.data(), bytecode.size(), "bytecode"); }, source.size());
+			benchmark("load.run_mapped", 100, [&lua, &bytecode_path]() { lua.RunMapped(bytecode_path); }, source.size());
+
+			std::filesystem::remove(source_path);
+			std::filesystem::remove(bytecode_path);
+		}
+
+		{
+			LuaCPP lua;
+			std::vector<uint8_t> bytecode;
+			auto source = generate_source(4 * 1024 * 1024);
+
+			lua.Compile(source, bytecode, false);
+
+			benchmark("compile.vector", 10, [&]() { lua.Compile(source, bytecode, false); }, source.size());
+
+			std::vector<uint8_t> arena(bytecode.size() * 2);
+
+			benchmark("compile.span", 10, [&]() { lua.Compile(source, std::span<uint8_t>(arena), false); }, source.size());
+		}
+
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.SetGlobal<&add>("add");
+			lua.RegisterClass<Counter, LuaCPP::Constructor<>, LuaCPP::Method<"Add", &Counter::Add>>("Counter");
+			lua.RegisterClass<CounterWithProperties, LuaCPP::Constructor<>, LuaCPP::Method<"Add", &CounterWithProperties::Add>, LuaCPP::Property<"value", &CounterWithProperties::value>>("CounterWithProperties");
+
+			benchmark("call.cfunction", 10, [&lua]() { lua.Run("local add, x = add, 0 for i = 1, 1000000 do x = add(x, 1) end"); });
+			benchmark("call.method", 10, [&lua]() { lua.Run("local c = Counter() for i = 1, 1000000 do c:Add(1) end"); });
+			benchmark("call.method.hashed", 10, [&lua]() { lua.Run("local c = CounterWithProperties() for i = 1, 1000000 do c:Add(1) end"); });
+			benchmark("call.property.hashed", 10, [&lua]() { lua.Run("local c = CounterWithProperties() for i = 1, 1000000 do c.value = c.value + 1 end"); });
+
+#if defined(LUACPP_INSTRUMENTATION)
+			std::cout << LuaCPP::DumpBindingStats();
+			LuaCPP::ResetBindingStats();
+#endif
+		}
+
+		{
+			LuaCPP lua;
+
+			std::vector<int64_t>                    array(1000000);
+			std::unordered_map<std::string, double> map;
+
+			for (size_t i = 0; i < array.size(); ++i)
+				array[i] = static_cast<int64_t>(i);
+
+			for (size_t i = 0; i < 100000; ++i)
+				map.emplace(std::to_string(i), static_cast<double>(i));
+
+			benchmark("table.push.vector", 10, [&lua, &array]() { lua.SetGlobal("array", array); }, array.size() * sizeof(int64_t));
+			benchmark("table.peek.vector", 10, [&lua, &array]() { lua.GetGlobal("array", array); }, array.size() * sizeof(int64_t));
+			benchmark("table.push.map", 10, [&lua, &map]() { lua.SetGlobal("map", map); });
+			benchmark("table.peek.map", 10, [&lua, &map]() { lua.GetGlobal("map", map); });
+		}
+
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.SetGlobal<&length_copied>("length_copied");
+			lua.SetGlobal<&length_anchored>("length_anchored");
+			lua.Run("payload = string.rep('x', 1024 * 1024)");
+
+			benchmark("string.argument.copied", 10000, [&lua]() { lua.Run("length_copied(payload)"); }, 1024 * 1024);
+			benchmark("string.argument.anchored", 10000, [&lua]() { lua.Run("length_anchored(payload)"); }, 1024 * 1024);
+
+			std::string            copied;
+			LuaCPP::AnchoredString anchored;
+
+			benchmark("string.pop.copied", 10000, [&lua, &copied]() { lua.GetGlobal("payload", copied); }, 1024 * 1024);
+			benchmark("string.pop.anchored", 10000, [&lua, &anchored]() { lua.GetGlobal("payload", anchored); }, 1024 * 1024);
+		}
+
+		{
+			LuaCPP lua;
+
+			constexpr size_t PAYLOAD_SIZE = 4 * 1024 * 1024;
+
+			std::string              payload(PAYLOAD_SIZE, 'x');
+			auto                     shared = std::make_shared<const std::string>(payload);
+			std::vector<std::string> strings(16, payload);
+			auto                     string = strings.begin();
+
+			benchmark("string.push.copied", 16, [&lua, &payload]() { lua.SetGlobal("payload", payload); lua.CollectGC(); }, PAYLOAD_SIZE);
+			benchmark("string.push.external.moved", 16, [&lua, &string]() { lua.SetGlobal("payload", LuaCPP::ExternalString(std::move(*string++))); lua.CollectGC(); }, PAYLOAD_SIZE);
+			benchmark("string.push.external.shared", 16, [&lua, &shared]() { lua.SetGlobal("payload", LuaCPP::ExternalString(shared)); lua.CollectGC(); }, PAYLOAD_SIZE);
+		}
+
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.Run(R"(
+				records = {}
+				for i = 1, 10000 do
+					records[i] = { id = i, name = 'record ' .. i, score = i * 0.5, active = (i % 2 == 0), tags = { 'a', 'b', 'c' } }
+				end
+			)");
+
+			std::vector<uint8_t> buffer;
+			lua.SerializeGlobal("records", buffer);
+
+			benchmark("serialize.records", 100, [&lua, &buffer]() { lua.SerializeGlobal("records", buffer); }, buffer.size());
+			benchmark("deserialize.records", 100, [&lua, &buffer]() { lua.DeserializeGlobal("copy", buffer); }, buffer.size());
+		}
+
+		{
+			LuaCPP lua;
+			lua.Run("function sum(t) local x = 0 for i = 1, #t do x = x + t[i] end return x end");
+
+			std::vector<double> samples(1000000, 1.0);
+			auto                view = lua.CreateArrayView(std::span<double>(samples));
+
+			benchmark("array.sum.table", 10, [&lua, &samples]()
+			{
+				lua.SetGlobal("samples", samples);
+				lua.Run("sum(samples)");
+			}, samples.size() * sizeof(double));
+			benchmark("array.sum.view", 10, [&lua, &view]()
+			{
+				lua.SetGlobal("samples", view);
+				lua.Run("sum(samples)");
+			}, samples.size() * sizeof(double));
+		}
+
+		{
+			LuaCPP lua;
+			lua.Run("function scale(x, y) return x * y end");
+
+			LuaCPP::Function<double(double, double)> scale;
+			lua.GetGlobal("scale", scale);
+
+			std::vector<std::tuple<double, double>> arguments(100000, { 2.0, 3.0 });
+			std::vector<double>                     values(arguments.size());
+
+			benchmark("function.execute", 10, [&scale, &arguments, &values]()
+			{
+				for (size_t i = 0; i < arguments.size(); ++i)
+					values[i] = scale.ExecuteProtected(std::get<0>(arguments[i]), std::get<1>(arguments[i]));
+			});
+			benchmark("function.execute_unprotected", 10, [&scale, &arguments, &values]()
+			{
+				for (size_t i = 0; i < arguments.size(); ++i)
+					values[i] = scale.Execute(std::get<0>(arguments[i]), std::get<1>(arguments[i]));
+			});
+			benchmark("function.execute_batch", 10, [&scale, &arguments, &values]()
+			{
+				scale.ExecuteBatch(arguments, values.begin());
+			});
+		}
+
+		{
+			LuaCPP lua;
+			lua.Run("function apply(f, n) local x = 0 for i = 1, n do x = f(x) end return x end");
+
+			int64_t step = 1;
+
+			benchmark("function.bind.std", 100000, [&lua, step]()
+			{
+				lua.SetGlobal("f", LuaCPP::Function<int64_t(int64_t)>([step](int64_t x) { return x + step; }));
+			});
+			benchmark("function.bind.inline", 100000, [&lua, step]()
+			{
+				lua.SetGlobal("f", LuaCPP::InlineFunction<int64_t(int64_t)>([step](int64_t x) { return x + step; }));
+			});
+
+			// Function pushes a pointer to its context, which has to outlive the calls
+			LuaCPP::Function<int64_t(int64_t)> function([step](int64_t x) { return x + step; });
+
+			lua.SetGlobal("f", function);
+			benchmark("function.call.std", 10, [&lua]() { lua.Run("apply(f, 1000000)"); });
+			lua.SetGlobal("f", LuaCPP::InlineFunction<int64_t(int64_t)>([step](int64_t x) { return x + step; }));
+			benchmark("function.call.inline", 10, [&lua]() { lua.Run("apply(f, 1000000)"); });
+		}
+
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.Run("function session(x) while true do x = coroutine.yield(x + 1) end end");
+
+			auto session = lua.CreateThread("session");
+
+			benchmark("thread.resume", 1000000, [&session]() { session.Resume(int64_t(1)); });
+		}
+
+		{
+			LuaCPP lua;
+			lua.Run("function spin(n) local x = 0 for i = 1, n do x = x + i end return x end");
+
+			benchmark("budget.none", 10, [&lua]() { lua.Run("spin(10000000)"); });
+
+			for (int interval : { 100, 1000, 10000 })
+			{
+				lua.SetBudget(UINT64_MAX, std::chrono::hours(1), interval);
+				benchmark(std::string("budget.interval_").append(std::to_string(interval)), 10, [&lua]() { lua.Run("spin(10000000)"); });
+			}
+
+			lua.SetBudget(1000000);
+
+			try
+			{
+				lua.Run("while true do end");
+			}
+			catch (const LuaCPP::BudgetException& exception)
+			{
+				std::cout << LUA_RELEASE << " budget.abort: " << exception.what() << std::endl;
+			}
+
+			lua.SetBudget(0);
+
+#if defined(__linux__)
+			lua.SetGlobal<&add>("add");
+			lua.Run("function work(n) local x = 0 for i = 1, n do x = add(x, i % 7) end return x end");
+
+			benchmark("profiler.off", 10, [&lua]() { lua.Run("work(5000000)"); });
+			lua.StartProfiler(1000);
+			benchmark("profiler.1khz", 10, [&lua]() { lua.Run("work(5000000)"); });
+			lua.StopProfiler();
+
+			std::cout << lua.GetProfile();
+#endif
+		}
+
+#if defined(__linux__)
+		{
+			LuaCPP lua;
+			lua.SetGlobal<&drain>("drain");
+			lua.Run("function reader(fd) while wait_readable(fd) and drain(fd) do end end");
+			lua.Run("function sleeper(n) for i = 1, n do sleep(0.001) end end");
+
+			LuaCPP::Scheduler               scheduler(lua);
+			std::vector<std::array<int, 2>> pairs(256);
+
+			for (auto& pair : pairs)
+			{
+				if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair.data()) == -1)
+					throw std::runtime_error("socketpair");
+
+				scheduler.Spawn("reader", int64_t(pair[0]));
+			}
+
+			benchmark("scheduler.socketpair", 1000, [&scheduler, &pairs]()
+			{
+				auto resumes = scheduler.GetStats().resumes + pairs.size();
+
+				for (auto& pair : pairs)
+					write(pair[1], "x", 1);
+
+				while (scheduler.GetStats().resumes < resumes)
+					scheduler.RunOnce();
+			});
+			print_latency("scheduler.socketpair", scheduler.GetStats());
+
+			for (auto& pair : pairs)
+				close(pair[1]);
+
+			scheduler.Run();
+
+			for (auto& pair : pairs)
+				close(pair[0]);
+
+			scheduler.ResetStats();
+
+			for (size_t i = 0; i < 1000; ++i)
+				scheduler.Spawn("sleeper", int64_t(100));
+
+			benchmark("scheduler.sleep", 1, [&scheduler]() { scheduler.Run(); });
+			print_latency("scheduler.sleep", scheduler.GetStats());
+		}
+
+		{
+			LuaCPP::Channel channel(1024);
+			LuaCPP          producer;
+			LuaCPP          consumer;
+
+			producer.SetGlobal("channel", channel);
+			producer.Run("function produce(n) for i = 1, n do while not channel:send({ id = i, name = 'message' }) do end end end");
+			consumer.SetGlobal("channel", channel);
+			consumer.Run("function consume(n) for i = 1, n do channel:recv() end end");
+
+			// receiver blocks its thread while the ring is empty
+			benchmark("channel.threads.blocking", 10, [&producer, &consumer]()
+			{
+				std::thread thread([&producer]() { producer.Run("produce(100000)"); });
+
+				consumer.Run("consume(100000)");
+				thread.join();
+			});
+
+			LuaCPP::Scheduler scheduler(consumer);
+
+			// receiver is a coroutine parked on the channel through wait_readable
+			benchmark("channel.threads.scheduled", 10, [&producer, &scheduler]()
+			{
+				scheduler.Spawn("consume", int64_t(100000));
+
+				std::thread thread([&producer]() { producer.Run("produce(100000)"); });
+
+				scheduler.Run();
+				thread.join();
+			});
+		}
+#endif
+
+		{
+			LuaCPP lua;
+			lua.LoadLibrary(LuaCPP::Libraries::All);
+			lua.Run("function handle() local t = {} for i = 1, 1000 do t[i] = { i, tostring(i) } end return #t end");
+
+			// stepped stops the collector during each request and pays for it in between
+			for (std::string_view mode : { "incremental", "generational", "stepped" })
+			{
+				std::chrono::nanoseconds request_max(0);
+
+				if (mode == "generational")
+					lua.SetGCGenerational();
+				else
+					lua.SetGCIncremental();
+
+				benchmark(std::string("gc.request.").append(mode), 1000, [&lua, &request_max, mode]()
+				{
+					auto start = std::chrono::steady_clock::now();
+
+					if (mode == "stepped")
+					{
+						LuaCPP::GCStopScope stop(lua);
+
+						lua.Run("handle()");
+					}
+					else
+						lua.Run("handle()");
+
+					request_max = (std::max)(request_max, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+
+					if (mode == "stepped")
+						lua.StepGCFor(std::chrono::microseconds(200));
+				});
+
+				std::cout << LUA_RELEASE << " gc.request." << mode << " max: " << request_max.count() << " ns" << std::endl;
+			}
+
+			if (auto stats = lua.GetGCStats())
+			{
+				std::cout << LUA_RELEASE << " gc.step: " << stats->steps << " steps, " << stats->cycles << " cycles, "
+					<< (stats->steps ? (stats->step_time.count() / static_cast<int64_t>(stats->steps)) : 0) << " ns mean, "
+					<< stats->step_time_max.count() << " ns max, " << stats->bytes_reclaimed << " bytes reclaimed" << std::endl;
+			}
+		}
+
+		for (size_t thread_count : { size_t(1), size_t(std::thread::hardware_concurrency()) })
+		{
+			LuaCPP::Executor executor(thread_count, [](LuaCPP& lua)
+			{
+				lua.LoadLibrary(LuaCPP::Libraries::All);
+				lua.Run("function work(n) local x = 0 for i = 1, n do x = x + i % 7 end return x end");
+			});
+
+			benchmark(std::string("executor.call.threads_").append(std::to_string(thread_count)), 10, [&executor]()
+			{
+				std::vector<std::future<int64_t>> results;
+
+				for (size_t i = 0; i < 256; ++i)
+					results.push_back(executor.Call<int64_t>("work", 100000));
+
+				for (auto& result : results)
+					result.get();
+			});
+		}
+	}
+	catch (const std::exception& exception)
+	{
+		std::cerr << exception.what() << std::endl;
+
+		return 1;
+	}
+
+	if (!json_path.empty() && !write_json(json_path))
+	{
+		std::cerr << "Error writing " << json_path << std::endl;
+
+		return 1;
+	}
+
+	return 0;
+}